@@ -0,0 +1,235 @@
+/* This file is part of wtmpclean', a tool for hacking the wtmp databases
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * libwtmpclean -- the reading, session pairing and editing functions of
+ * wtmpclean, for programs that want to embed them.
+ *
+ * The functions never print anything and never exit: they return 0 (or a
+ * positive value) on success and one of the WTMP_E* codes on failure.
+ * The functions returning a pointer return NULL on failure and set errno.
+ *
+ * The file offsets are int64_t's, whatever the size of off_t in the
+ * programs using the library, which need not be built with large file
+ * support like the library is.
+ */
+
+#ifndef LIBWTMPCLEAN_H
+#define LIBWTMPCLEAN_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifndef UTMP_STRUCT_NAME
+/* Not built with the wtmpclean configuration: use the POSIX interface */
+# include <utmpx.h>
+# define UTMP_STRUCT_NAME utmpx
+typedef struct utmpx STRUCT_UTMP;
+#endif
+
+/* Error codes */
+#define WTMP_ESYS     -1        /* system error, the cause is in errno */
+#define WTMP_ENOTREG  -2        /* the wtmp file is not a regular file */
+#define WTMP_ELAYOUT  -3        /* the records have a foreign layout */
+#define WTMP_EREGEX   -4        /* invalid regular expression */
+#define WTMP_EJOURNAL -5        /* not a valid undo journal */
+#define WTMP_ECHANGED -6        /* the records differ from the journal */
+#define WTMP_ERULE    -7        /* invalid anonymization rule */
+#define WTMP_EKEY     -8        /* the key file is too short */
+#define WTMP_ETRUNCATED -9      /* the file was truncated during the scan */
+
+/* Types of listing */
+#define R_NONE        0
+#define R_CRASH       1         /* No logout record, system boot in between */
+#define R_DOWN        2         /* System brought down in decent way */
+#define R_NORMAL      3         /* Normal */
+#define R_NOW         4         /* Still logged in */
+#define R_REBOOT      5         /* Reboot record. */
+#define R_PHANTOM     6         /* No logout record but session is stale. */
+#define R_TIMECHANGE  7         /* NEW_TIME or OLD_TIME */
+
+/* Double linked list of struct UTMP_STRUCT_NAME's */
+struct utmpxlist
+{
+    STRUCT_UTMP ut;
+    time_t eos;                 /* end of session */
+    time_t delta;               /* time difference */
+    int ltype;                  /* R_NONE, R_CRASH, ... */
+    struct utmpxlist *prev, *next;
+};
+
+/* Record layout of a wtmp file (see wtmplayout.c) */
+struct wtmplayout
+{
+    const char *name;
+    size_t recsize;             /* size of a record on disk */
+    /* translate 'nrec' records into STRUCT_UTMP's; NULL for the native
+       layout, whose records are used as they are */
+    void (*decode) (const char *src, size_t nrec, STRUCT_UTMP *dst);
+};
+
+struct wtmpasync;
+
+/* Record iterator.  The records returned by wtmpreader_next() point into
+ * the mapped file or into the read buffer and are not copied, unless they
+ * must be decoded from a foreign layout.  */
+struct wtmpreader
+{
+    int fd;
+    const struct wtmplayout *layout;
+    char *buf;
+    size_t bufsize;             /* size of the read buffer */
+    size_t len;                 /* number of bytes in the read buffer */
+    size_t pos;                 /* position of the next record in buf */
+    size_t recpos;              /* position of the last returned record */
+    int64_t offset;             /* file offset of buf[0] */
+    STRUCT_UTMP *dec;           /* records decoded from a foreign layout */
+    size_t ndec, decpos;
+    int mapped;                 /* buf is a read-only mapping of the file */
+    int error;                  /* set when wtmpreader_next() fails */
+    int flags;
+    int64_t size;               /* end of the snapshot read, or -1 */
+    int64_t advised;            /* end of the range announced to the kernel */
+    int64_t dropped;            /* end of the range dropped from the cache */
+    struct wtmpasync *async;    /* reads in flight with WTMPREADER_ASYNC */
+};
+
+/* Flags of wtmpreader_open() */
+#define WTMPREADER_MMAP      1  /* map the file instead of reading it */
+#define WTMPREADER_DONTNEED  2  /* drop the scanned pages from the cache */
+#define WTMPREADER_ASYNC     4  /* keep several reads in flight (io_uring) */
+#define WTMPREADER_TAIL      8  /* then read the records appended meanwhile */
+
+/* Copy methods returned by wtmpbackup() */
+#define WTMPBACKUP_CLONE      0 /* extents shared with the original */
+#define WTMPBACKUP_COPYRANGE  1 /* copy_file_range(2) */
+#define WTMPBACKUP_SENDFILE   2 /* sendfile(2) */
+#define WTMPBACKUP_READWRITE  3 /* read(2) and write(2) */
+
+/* Flags of wtmpmerge() */
+#define WTMPMERGE_DEDUP  1      /* drop the records already written */
+
+/* Periods of wtmpsplit() and wtmpperiod() */
+#define WTMPSPLIT_DAY    1
+#define WTMPSPLIT_WEEK   2      /* ISO 8601 week, from Monday */
+#define WTMPSPLIT_MONTH  3
+#define WTMPSPLIT_HOUR   4
+
+/* Phases of a run timed by the performance counters */
+#define WTMPSTATS_NONE       0
+#define WTMPSTATS_OPEN       1  /* open, lock, probe the layout */
+#define WTMPSTATS_SCAN       2  /* read and decode the records */
+#define WTMPSTATS_PAIR       3  /* pair or select the records */
+#define WTMPSTATS_LIVENESS   4  /* check the processes still running */
+#define WTMPSTATS_FORMAT     5  /* print the records or the sessions */
+#define WTMPSTATS_WRITEBACK  6  /* journal and write the patched records */
+#define WTMPSTATS_NPHASES    7
+
+/* Performance counters, only updated when wtmpstats_enabled is set */
+struct wtmpstats
+{
+    unsigned long long scanned, matched, written;       /* records */
+    unsigned long long bytesread, byteswritten;
+    unsigned long long readcalls, writecalls;
+    unsigned long long regexevals, timeconv, allocs;
+    double wall[WTMPSTATS_NPHASES];     /* seconds spent in each phase */
+    double cpu[WTMPSTATS_NPHASES];
+};
+
+extern struct wtmpstats wtmpstats;
+extern int wtmpstats_enabled;
+
+/* Set to read, at the end of the read-only scans, the records appended to
+ * the file during the scan (WTMPREADER_TAIL) */
+extern int wtmpreader_tail;
+
+/* Queries supported by the sidecar index */
+#define IDX_QUERY_RAW   1       /* all the records of a user */
+#define IDX_QUERY_LIST  2       /* the records needed to list the sessions */
+
+struct wtmpindex;
+struct wtmpanon;
+struct wtmppseudo;
+struct wtmppair;
+
+const char *wtmpstrerror (int err);
+int wtmpstats_phase (int phase);
+char *timetostr (const time_t time);
+
+const struct wtmplayout *wtmplayout_native (void);
+const struct wtmplayout *wtmplayout_probe (int fd, int64_t size);
+
+int wtmpreader_open (struct wtmpreader *rd, const char *wtmpfile, int flags);
+STRUCT_UTMP *wtmpreader_next (struct wtmpreader *rd);
+int wtmpreader_error (const struct wtmpreader *rd);
+int64_t wtmpreader_tell (const struct wtmpreader *rd);
+int wtmpreader_seek (struct wtmpreader *rd, int64_t offset);
+void wtmpreader_close (struct wtmpreader *rd);
+
+int wtmpindex_build (const char *wtmpfile, unsigned long *nrec,
+                     unsigned long *newrec);
+int wtmpindex_remove (const char *wtmpfile);
+int wtmpgeneration_bump (const char *wtmpfile);
+int64_t wtmpgeneration (const char *wtmpfile);
+struct wtmpindex *wtmpindex_open (const char *wtmpfile, const char *user,
+                                  int query);
+STRUCT_UTMP *wtmpindex_next (struct wtmpindex *idx);
+int wtmpindex_error (const struct wtmpindex *idx);
+void wtmpindex_close (struct wtmpindex *idx);
+
+int wtmpsessions (const char *wtmpfile, const char *user,
+                  struct utmpxlist **sessions);
+void wtmpsessions_free (struct utmpxlist *sessions);
+
+struct wtmppair *wtmppair_new (void);
+int wtmppair_feed (struct wtmppair *pair, const STRUCT_UTMP *utp,
+                   int64_t offset, struct utmpxlist *session);
+void wtmppair_reset (struct wtmppair *pair);
+void wtmppair_onclose (struct wtmppair *pair,
+                       void (*fn) (struct utmpxlist *session, void *arg),
+                       void *arg);
+void wtmppair_free (struct wtmppair *pair);
+
+int wtmpedit (const char *wtmpfile, const char *user, const char *fake,
+              const char *timepattern, const char *journal,
+              unsigned int *cleanrec);
+int wtmprevert (const char *wtmpfile, const char *journal,
+                unsigned int *nrec);
+int wtmpbackup (const char *wtmpfile, const char *backup);
+
+int wtmpanon_load (const char *rulesfile, struct wtmpanon **anon,
+                   unsigned int *line);
+int wtmpanon (const char *wtmpfile, const struct wtmpanon *anon,
+              const char *journal, unsigned int *cleanrec);
+void wtmpanon_free (struct wtmpanon *anon);
+
+int wtmppseudo_load (const char *keyfile, struct wtmppseudo **pseudo);
+int wtmppseudo (const char *wtmpfile, struct wtmppseudo *pseudo,
+                const char *journal, unsigned int *cleanrec);
+void wtmppseudo_free (struct wtmppseudo *pseudo);
+
+int wtmpmerge (const char *output, char *const *inputs, int ninputs,
+               int flags, unsigned long *nrec, unsigned long *ndup);
+int wtmpextract (const char *wtmpfile, const char *user,
+                 const char *timepattern, int out, unsigned long *nrec);
+int wtmpperiod (time_t t, int period, time_t *start, time_t *end,
+                char *suffix, size_t size);
+int wtmpsplit (const char *wtmpfile, const char *outdir, int period,
+               unsigned long *nrec, unsigned int *nfiles);
+
+#endif /* LIBWTMPCLEAN_H */
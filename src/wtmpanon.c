@@ -0,0 +1,464 @@
+/*
+ * wtmpanon.c -- Anonymization of the remote hosts and addresses.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Each line of a rules file holds a network in CIDR notation (10.0.0.0/8,
+ * 2001:db8::/32, or a single address) or a domain name (example.com, that
+ * also stands for all its subdomains), optionally followed by the text
+ * that replaces ut_host in the matching records (default: nothing).
+ * The address of the matching records is truncated to the network of the
+ * rule, or cleared for the domain rules.  Empty lines and the lines
+ * starting with '#' are ignored.
+ *
+ * The networks are stored in two binary prefix trees (IPv4 and IPv6), and
+ * the domains in a tree of the reversed names, so that the rule of a record
+ * is found in a time bound by the length of its address or host name,
+ * whatever the number of rules.  The most specific rule wins.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "wtmpclean.h"
+
+#define NORULE  (-1)
+
+struct anonrule
+{
+    unsigned char net[16];      /* network address, host bits cleared */
+    int bits;                   /* prefix length, -1 for a domain rule */
+    char *host;                 /* replacement of ut_host, or NULL */
+};
+
+/* Node of a binary prefix tree; child 0 is the null link, since the
+ * roots are never a child */
+struct addrnode
+{
+    uint32_t child[2];
+    int rule;
+};
+
+/* Node of the tree of the reversed domain names (first child, next
+ * sibling) */
+struct namenode
+{
+    uint32_t child, sibling;
+    int c;
+    int rule;
+};
+
+struct wtmpanon
+{
+    struct anonrule *rules;
+    size_t nrules, rulesalloc;
+    struct addrnode *addr;      /* addr[0]: IPv4 root, addr[1]: IPv6 root */
+    size_t naddr, addralloc;
+    struct namenode *name;      /* name[0]: root */
+    size_t nname, namealloc;
+};
+
+/* Return 'array', of 'n' elements of 'size' bytes, grown if needed to
+ * hold one more element, or NULL if out of memory */
+static void *
+grow (void *array, size_t *alloc, size_t n, size_t size)
+{
+    void *more;
+
+    if (n < *alloc)
+        return array;
+    if ((more = realloc (array, (*alloc ? 2 * *alloc : 64) * size)) == NULL)
+        return NULL;
+    *alloc = *alloc ? 2 * *alloc : 64;
+    STATS_ADD (allocs, 1);
+
+    return more;
+}
+
+static int
+addrnode_new (struct wtmpanon *a, uint32_t *index)
+{
+    struct addrnode *more;
+
+    if ((more = grow (a->addr, &a->addralloc, a->naddr,
+                      sizeof (struct addrnode))) == NULL)
+        return WTMP_ESYS;
+    a->addr = more;
+
+    memset (&a->addr[a->naddr], 0, sizeof (struct addrnode));
+    a->addr[a->naddr].rule = NORULE;
+    *index = a->naddr++;
+
+    return 0;
+}
+
+static int
+namenode_new (struct wtmpanon *a, uint32_t *index, int c)
+{
+    struct namenode *more;
+
+    if ((more = grow (a->name, &a->namealloc, a->nname,
+                      sizeof (struct namenode))) == NULL)
+        return WTMP_ESYS;
+    a->name = more;
+
+    memset (&a->name[a->nname], 0, sizeof (struct namenode));
+    a->name[a->nname].c = c;
+    a->name[a->nname].rule = NORULE;
+    *index = a->nname++;
+
+    return 0;
+}
+
+static inline int
+bit (const unsigned char *addr, int i)
+{
+    return (addr[i / 8] >> (7 - i % 8)) & 1;
+}
+
+/* Insert the network of 'rule' in the tree of 'family' */
+static int
+addrinsert (struct wtmpanon *a, int family, int rule)
+{
+    const struct anonrule *r = &a->rules[rule];
+    uint32_t node = (family == AF_INET) ? 0 : 1, next;
+    int i, b;
+
+    for (i = 0; i < r->bits; i++)
+      {
+          b = bit (r->net, i);
+          if (a->addr[node].child[b] == 0)
+            {
+                if (addrnode_new (a, &next) < 0)
+                    return WTMP_ESYS;
+                a->addr[node].child[b] = next;
+            }
+          node = a->addr[node].child[b];
+      }
+    /* The first rule given for a network is kept */
+    if (a->addr[node].rule == NORULE)
+        a->addr[node].rule = rule;
+
+    return 0;
+}
+
+/* Return the rule of the longest prefix of 'addr' (4 or 16 bytes) */
+static int
+addrlookup (const struct wtmpanon *a, int family, const unsigned char *addr)
+{
+    const int nbits = (family == AF_INET) ? 32 : 128;
+    uint32_t node = (family == AF_INET) ? 0 : 1;
+    int i, rule = a->addr[node].rule;
+
+    for (i = 0; i < nbits; i++)
+      {
+          if ((node = a->addr[node].child[bit (addr, i)]) == 0)
+              break;
+          if (a->addr[node].rule != NORULE)
+              rule = a->addr[node].rule;
+      }
+
+    return rule;
+}
+
+/* Insert the domain 'name', of length 'len', read backwards */
+static int
+nameinsert (struct wtmpanon *a, const char *name, size_t len, int rule)
+{
+    uint32_t node = 0, child, next;
+    int c;
+
+    while (len-- > 0)
+      {
+          c = tolower ((unsigned char) name[len]);
+          for (child = a->name[node].child; child;
+               child = a->name[child].sibling)
+              if (a->name[child].c == c)
+                  break;
+          if (child == 0)
+            {
+                if (namenode_new (a, &next, c) < 0)
+                    return WTMP_ESYS;
+                a->name[next].sibling = a->name[node].child;
+                a->name[node].child = next;
+                child = next;
+            }
+          node = child;
+      }
+    if (a->name[node].rule == NORULE)
+        a->name[node].rule = rule;
+
+    return 0;
+}
+
+/* Return the rule of the longest domain that 'host' belongs to */
+static int
+namelookup (const struct wtmpanon *a, const char *host, size_t len)
+{
+    uint32_t node = 0;
+    size_t i = len;
+    int c, rule = NORULE;
+
+    while (i-- > 0)
+      {
+          c = tolower ((unsigned char) host[i]);
+          for (node = a->name[node].child; node; node = a->name[node].sibling)
+              if (a->name[node].c == c)
+                  break;
+          if (node == 0)
+              break;
+          /* A domain only matches whole labels */
+          if (a->name[node].rule != NORULE && (i == 0 || host[i - 1] == '.'))
+              rule = a->name[node].rule;
+      }
+
+    return rule;
+}
+
+/* Parse the rule 'pattern' and add it with the replacement 'host' */
+static int
+ruleadd (struct wtmpanon *a, char *pattern, const char *host)
+{
+    struct anonrule *r;
+    char *slash, *end;
+    long bits = -1;
+    int family = 0, maxbits, i;
+
+    if ((r = grow (a->rules, &a->rulesalloc, a->nrules,
+                   sizeof (struct anonrule))) == NULL)
+        return WTMP_ESYS;
+    a->rules = r;
+    r = &a->rules[a->nrules];
+    memset (r, 0, sizeof (struct anonrule));
+
+    if ((slash = strchr (pattern, '/')) != NULL)
+        *slash = '\0';
+    if (inet_pton (AF_INET, pattern, r->net) == 1)
+        family = AF_INET;
+    else if (inet_pton (AF_INET6, pattern, r->net) == 1)
+        family = AF_INET6;
+
+    if (family)
+      {
+          maxbits = (family == AF_INET) ? 32 : 128;
+          bits = maxbits;
+          if (slash)
+            {
+                bits = strtol (slash + 1, &end, 10);
+                if (slash[1] == '\0' || *end || bits < 0 || bits > maxbits)
+                    return WTMP_ERULE;
+            }
+          for (i = bits; i < maxbits; i++)
+              r->net[i / 8] &= ~(0x80 >> (i % 8));
+      }
+    else
+      {
+          if (slash)
+              return WTMP_ERULE;
+          while (*pattern == '.')
+              pattern++;
+          if (*pattern == '\0')
+              return WTMP_ERULE;
+      }
+
+    r->bits = (int) bits;
+    if (host && (r->host = strdup (host)) == NULL)
+        return WTMP_ESYS;
+    a->nrules++;
+
+    if (family)
+        return addrinsert (a, family, a->nrules - 1);
+    return nameinsert (a, pattern, strlen (pattern), a->nrules - 1);
+}
+
+/* Load the anonymization rules from 'rulesfile'.  Return 0 or a WTMP_E*
+ * error code; on WTMP_ERULE, 'line' is the number of the bad line.  */
+int
+wtmpanon_load (const char *rulesfile, struct wtmpanon **anon,
+               unsigned int *line)
+{
+    struct wtmpanon *a;
+    char buf[512], *pattern, *host, *save;
+    uint32_t root;
+    FILE *fp;
+    int rc = 0;
+
+    *anon = NULL;
+    *line = 0;
+    if ((a = calloc (1, sizeof (struct wtmpanon))) == NULL)
+        return WTMP_ESYS;
+    if (addrnode_new (a, &root) < 0 || addrnode_new (a, &root) < 0 ||
+        namenode_new (a, &root, 0) < 0)
+      {
+          wtmpanon_free (a);
+          return WTMP_ESYS;
+      }
+
+    if ((fp = fopen (rulesfile, "r")) == NULL)
+      {
+          wtmpanon_free (a);
+          return WTMP_ESYS;
+      }
+    while (rc == 0 && fgets (buf, sizeof buf, fp))
+      {
+          (*line)++;
+          if ((pattern = strtok_r (buf, " \t\r\n", &save)) == NULL ||
+              *pattern == '#')
+              continue;
+          host = strtok_r (NULL, " \t\r\n", &save);
+          if (strtok_r (NULL, " \t\r\n", &save))
+              rc = WTMP_ERULE;
+          else
+              rc = ruleadd (a, pattern, host);
+      }
+    if (rc == 0 && ferror (fp))
+        rc = WTMP_ESYS;
+    fclose (fp);
+
+    if (rc < 0)
+        wtmpanon_free (a);
+    else
+        *anon = a;
+
+    return rc;
+}
+
+void
+wtmpanon_free (struct wtmpanon *anon)
+{
+    size_t i;
+
+    if (!anon)
+        return;
+    for (i = 0; i < anon->nrules; i++)
+        free (anon->rules[i].host);
+    free (anon->rules);
+    free (anon->addr);
+    free (anon->name);
+    free (anon);
+}
+
+/* Return the rule matching the address or the host name of 'utp'.  Set
+ * 'byaddr' if the rule matches the address stored in ut_addr_v6.  */
+static int
+anonlookup (const struct wtmpanon *a, const STRUCT_UTMP *utp, int *byaddr)
+{
+    unsigned char addr[16];
+    char host[sizeof utp->ut_host + 1];
+    size_t len;
+    int rule, pos, family;
+
+    *byaddr = 0;
+#ifdef HAVE_UTP_UT_ADDR_V6
+    memcpy (addr, utp->ut_addr_v6, sizeof addr);
+    if ((pos = wtmpaddrfield (addr, &family)) >= 0 &&
+        (rule = addrlookup (a, family, addr + pos)) != NORULE)
+      {
+          *byaddr = 1;
+          return rule;
+      }
+#else
+    (void) pos;
+    (void) family;
+#endif
+
+    len = strnlen (utp->ut_host, sizeof utp->ut_host);
+    if (len == 0)
+        return NORULE;
+    memcpy (host, utp->ut_host, len);
+    host[len] = '\0';
+
+    /* A host that was not resolved is stored as an address */
+    if (inet_pton (AF_INET, host, addr) == 1)
+        return addrlookup (a, AF_INET, addr);
+    if (inet_pton (AF_INET6, host, addr) == 1)
+        return addrlookup (a, AF_INET6, addr);
+
+    return namelookup (a, host, len);
+}
+
+static int
+anonpatch (const STRUCT_UTMP *utp, STRUCT_UTMP *rec, void *arg)
+{
+    const struct wtmpanon *a = arg;
+    const struct anonrule *r;
+    int rule, byaddr;
+
+    if ((rule = anonlookup (a, utp, &byaddr)) == NORULE)
+        return 0;
+    r = &a->rules[rule];
+
+    memcpy (rec, utp, sizeof (STRUCT_UTMP));
+    memset (rec->ut_host, 0, sizeof rec->ut_host);
+    if (r->host)
+        strncpy (rec->ut_host, r->host, sizeof rec->ut_host);
+#ifdef HAVE_UTP_UT_ADDR_V6
+    /* Keep the network of the address matched by the rule, clear any
+       other address */
+    if (byaddr)
+      {
+          unsigned char addr[16];
+          int pos, family, i;
+
+          memcpy (addr, rec->ut_addr_v6, sizeof addr);
+          pos = wtmpaddrfield (addr, &family);
+          for (i = r->bits; i < ((family == AF_INET) ? 32 : 128); i++)
+              addr[pos + i / 8] &= ~(0x80 >> (i % 8));
+          memcpy (rec->ut_addr_v6, addr, sizeof addr);
+      }
+    else
+        memset (rec->ut_addr_v6, 0, sizeof rec->ut_addr_v6);
+#endif
+
+    /* The records already anonymized are left alone */
+    return memcmp (rec, utp, sizeof (STRUCT_UTMP)) != 0;
+}
+
+/* Rewrite the host and the address of the records of 'wtmpfile' matching
+ * one of the rules 'anon', in a single pass (see wtmpedit_apply).  */
+int
+wtmpanon (const char *wtmpfile, const struct wtmpanon *anon,
+          const char *journal, unsigned int *cleanrec)
+{
+    return wtmpedit_apply (wtmpfile, anonpatch, (void *) anon,
+                           WTMPEDIT_PARALLEL, journal, cleanrec);
+}
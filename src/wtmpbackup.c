@@ -0,0 +1,317 @@
+/*
+ * wtmpbackup.c -- Snapshots of the wtmp files.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#define _GNU_SOURCE             /* copy_file_range, splice */
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+#ifdef HAVE_STRINGS_H
+# include <strings.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_LINUX_FS_H
+# include <linux/fs.h>         /* FICLONE */
+#endif
+#ifdef HAVE_SYS_IOCTL_H
+# include <sys/ioctl.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
+#include <unistd.h>
+#include <utime.h>
+
+#include "wtmpclean.h"
+
+/* Size of the chunks copied by the streaming methods */
+#define BACKUP_CHUNK  (1 << 20)
+
+static int
+copyreadwrite (int in, int out)
+{
+    char *buf, *p;
+    ssize_t nread, nwritten;
+
+    if ((buf = malloc (BACKUP_CHUNK)) == NULL)
+        return -1;
+    while ((nread = read (in, buf, BACKUP_CHUNK)) != 0)
+      {
+          if (nread < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                free (buf);
+                return -1;
+            }
+          for (p = buf; nread > 0; p += nwritten, nread -= nwritten)
+              if ((nwritten = write (out, p, nread)) < 0)
+                {
+                    if (errno == EINTR)
+                      {
+                          nwritten = 0;
+                          continue;
+                      }
+                    free (buf);
+                    return -1;
+                }
+      }
+    free (buf);
+
+    return 0;
+}
+
+/* Copy 'size' bytes from 'in' to 'out' with the fastest method available
+ * and return the method used, or -1 on error.  */
+static int
+copyfile (int in, int out, off_t size)
+{
+    off_t done = 0;
+    ssize_t n = 0;
+
+#ifdef FICLONE
+    /* Share the extents of the file (btrfs, xfs): constant time */
+    if (ioctl (out, FICLONE, in) == 0)
+        return WTMPBACKUP_CLONE;
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+    /* In-kernel copy, which can still share the extents or offload the
+       copy to the storage */
+    while (done < size)
+      {
+          if ((n = copy_file_range (in, NULL, out, NULL,
+                                    size - done < BACKUP_CHUNK * 64 ?
+                                    (size_t) (size - done) :
+                                    (size_t) BACKUP_CHUNK * 64, 0)) <= 0)
+              break;
+          done += n;
+      }
+    if (done >= size)
+        return WTMPBACKUP_COPYRANGE;
+    if (done > 0 && n < 0)
+        return -1;
+#endif
+
+#ifdef HAVE_SYS_SENDFILE_H
+    while (done < size)
+      {
+          if ((n = sendfile (out, in, NULL, size - done < BACKUP_CHUNK * 64 ?
+                             (size_t) (size - done) :
+                             (size_t) BACKUP_CHUNK * 64)) <= 0)
+              break;
+          done += n;
+      }
+    if (done >= size)
+        return WTMPBACKUP_SENDFILE;
+    if (done > 0 && n < 0)
+        return -1;
+#endif
+
+    if (lseek (in, done, SEEK_SET) < 0 || lseek (out, done, SEEK_SET) < 0 ||
+        copyreadwrite (in, out) < 0)
+        return -1;
+
+    return WTMPBACKUP_READWRITE;
+}
+
+/* Return 1 if the error of a copy in the kernel means that the method is
+ * not supported by the kernel or by the files */
+static int
+unsupported (int err)
+{
+    return err == EINVAL || err == ENOSYS || err == EXDEV ||
+        err == EOPNOTSUPP || err == EBADF;
+}
+
+/* Append the 'len' bytes at 'offset' of the file 'in' to 'out', at its
+ * current position.  The bytes are copied in the kernel, with
+ * copy_file_range(2) to a regular file and with splice(2) to a pipe, and
+ * go through a buffer otherwise.  '*method' is the method to use, one of
+ * the WTMPCOPY_* values or -1 to pick it the first time, and is downgraded
+ * to WTMPCOPY_READWRITE if the kernel or the files do not support it.
+ * Return 0 or WTMP_ESYS.  */
+int
+wtmpcopyrange (int in, off_t offset, int out, size_t len, int *method)
+{
+    char buf[BACKUP_CHUNK / 16], *p;
+    struct stat sb;
+    ssize_t n, nwritten;
+
+    if (*method < 0)
+      {
+          if (fstat (out, &sb) < 0)
+              return WTMP_ESYS;
+          *method = S_ISREG (sb.st_mode) ? WTMPCOPY_RANGE :
+              S_ISFIFO (sb.st_mode) ? WTMPCOPY_SPLICE : WTMPCOPY_READWRITE;
+      }
+
+    while (len > 0)
+      {
+          n = -1;
+          errno = ENOSYS;
+#ifdef HAVE_COPY_FILE_RANGE
+          if (*method == WTMPCOPY_RANGE)
+              n = copy_file_range (in, &offset, out, NULL, len, 0);
+#endif
+#ifdef HAVE_SPLICE
+          if (*method == WTMPCOPY_SPLICE)
+              n = splice (in, &offset, out, NULL, len, SPLICE_F_MORE);
+#endif
+          if (*method != WTMPCOPY_READWRITE)
+            {
+                STATS_ADD (writecalls, 1);
+                if (n > 0)
+                  {
+                      STATS_ADD (byteswritten, n);
+                      len -= n;
+                      continue;
+                  }
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0 && !unsupported (errno))
+                    return WTMP_ESYS;
+                /* Go on with a buffer, that also reports a short file */
+                *method = WTMPCOPY_READWRITE;
+            }
+
+          if ((n = pread (in, buf, len < sizeof buf ? len : sizeof buf,
+                          offset)) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return WTMP_ESYS;
+            }
+          STATS_ADD (readcalls, 1);
+          STATS_ADD (bytesread, n);
+          if (n == 0)
+            {
+                errno = EIO;
+                return WTMP_ESYS;
+            }
+          offset += n;
+          len -= n;
+          for (p = buf; n > 0; p += nwritten, n -= nwritten)
+            {
+                if ((nwritten = write (out, p, n)) < 0)
+                  {
+                      if (errno != EINTR)
+                          return WTMP_ESYS;
+                      nwritten = 0;
+                  }
+                STATS_ADD (writecalls, 1);
+                STATS_ADD (byteswritten, nwritten);
+            }
+      }
+
+    return 0;
+}
+
+/* Save a copy of 'wtmpfile' in 'backup', with the same mode, ownership and
+ * times.  The file is cloned when the filesystem supports it, and streamed
+ * in the kernel otherwise.  Return the method used (WTMPBACKUP_*) or a
+ * WTMP_E* error code.  */
+int
+wtmpbackup (const char *wtmpfile, const char *backup)
+{
+    struct stat sb;
+    struct flock lock;
+    int in, out = -1, rc = WTMP_ESYS, saved_errno;
+#ifdef HAVE_FUTIMENS
+    struct timespec times[2];
+#else
+    struct utimbuf times;
+#endif
+
+    if ((in = open (wtmpfile, O_RDONLY)) < 0)
+        return WTMP_ESYS;
+
+    /* Wait for the edits in progress */
+    memset (&lock, 0, sizeof lock);
+    lock.l_type = F_RDLCK;
+    lock.l_whence = SEEK_SET;
+    if (fcntl (in, F_SETLKW, &lock) < 0 || fstat (in, &sb) < 0)
+        goto out;
+    if (!S_ISREG (sb.st_mode))
+      {
+          rc = WTMP_ENOTREG;
+          goto out;
+      }
+
+    if ((out = open (backup, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0 ||
+        (rc = copyfile (in, out, sb.st_size)) < 0)
+      {
+          rc = WTMP_ESYS;
+          goto out;
+      }
+
+    /* Failing to preserve the ownership is not fatal */
+    if (fchown (out, sb.st_uid, sb.st_gid) < 0)
+        errno = 0;
+#ifdef HAVE_FUTIMENS
+    times[0] = sb.st_atim;
+    times[1] = sb.st_mtim;
+    if (fchmod (out, sb.st_mode & 07777) < 0 || futimens (out, times) < 0 ||
+        fsync (out) < 0)
+        rc = WTMP_ESYS;
+#else
+    times.actime = sb.st_atime;
+    times.modtime = sb.st_mtime;
+    if (fchmod (out, sb.st_mode & 07777) < 0 || fsync (out) < 0 ||
+        utime (backup, &times) < 0)
+        rc = WTMP_ESYS;
+#endif
+
+  out:
+    saved_errno = errno;
+    if (out >= 0 && close (out) < 0 && rc >= 0)
+      {
+          saved_errno = errno;
+          rc = WTMP_ESYS;
+      }
+    if (out >= 0 && rc < 0)
+        unlink (backup);
+    close (in);
+    errno = saved_errno;
+
+    return rc;
+}
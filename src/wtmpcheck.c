@@ -0,0 +1,229 @@
+/*
+ * wtmpcheck.c -- Integrity checks of the wtmp files.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wtmpclean.h"
+
+static const char *checkfile;
+static int checkformat;
+static unsigned long nproblems;
+static size_t checkrecsize;
+
+static void
+report (off_t offset, const char *problem, const char *fmt, ...)
+    __attribute__ ((format (printf, 3, 4)));
+
+/* Print the JSON string of 's', quoted and escaped */
+static void
+jsonstring (const char *s)
+{
+    putchar ('"');
+    for (; *s; s++)
+      {
+          if (*s == '"' || *s == '\\')
+              printf ("\\%c", *s);
+          else if ((unsigned char) *s < 0x20)
+              printf ("\\u%04x", (unsigned char) *s);
+          else
+              putchar (*s);
+      }
+    putchar ('"');
+}
+
+static void
+report (off_t offset, const char *problem, const char *fmt, ...)
+{
+    va_list args;
+    char detail[128];
+
+    va_start (args, fmt);
+    vsnprintf (detail, sizeof detail, fmt, args);
+    va_end (args);
+
+    if (checkformat == CHECK_JSON)
+      {
+          printf ("{\"file\":");
+          jsonstring (checkfile);
+          printf (",\"offset\":%lld,\"record\":%lld,\"problem\":",
+                  (long long) offset,
+                  (long long) (offset / (off_t) checkrecsize));
+          jsonstring (problem);
+          printf (",\"detail\":");
+          jsonstring (detail);
+          printf ("}\n");
+      }
+    else
+        printf ("%s:%lld: record %lld: %s: %s\n",
+                checkfile, (long long) offset,
+                (long long) (offset / (off_t) checkrecsize),
+                problem, detail);
+
+    nproblems++;
+}
+
+/* Return 1 if the string field 'p' of size 'len' contains non printable
+ * characters, or if it is not followed by null bytes only  */
+static int
+badstring (const char *p, size_t len)
+{
+    size_t i = 0;
+
+    for (; i < len && p[i]; i++)
+        if ((unsigned char) p[i] < 0x20 || p[i] == 0x7f)
+            return 1;
+    for (; i < len; i++)
+        if (p[i])
+            return 1;
+
+    return 0;
+}
+
+/* Check the integrity of 'wtmpfile' and report all the problems found.
+ * Return the number of problems.  */
+unsigned long
+wtmpcheck (const char *wtmpfile, int format)
+{
+    static const STRUCT_UTMP zero;
+    struct wtmpreader rd;
+    struct stat sb;
+    STRUCT_UTMP *utp;
+    off_t offset, zerostart = -1;
+    unsigned long nrecords = 0, nzero = 0;
+    time_t prevtime = 0, t;
+    int timechange = 0, rc;
+
+    checkfile = wtmpfile;
+    checkformat = format;
+    nproblems = 0;
+
+    if ((rc = wtmpreader_open (&rd, wtmpfile,
+                               WTMPREADER_ASYNC | WTMPREADER_MMAP |
+                               WTMPREADER_DONTNEED |
+                               (wtmpreader_tail ? WTMPREADER_TAIL : 0))) < 0)
+        die (0, "%s: %s", wtmpfile, wtmpstrerror (rc));
+    if (fstat (rd.fd, &sb) < 0)
+        die (errno, "cannot get file status");
+    checkrecsize = rd.layout->recsize;
+
+    while ((utp = wtmpreader_next (&rd)) != NULL)
+      {
+          offset = wtmpreader_tell (&rd);
+          nrecords++;
+
+          /* Zeroed blocks are reported once, with their length */
+          if (memcmp (utp, &zero, sizeof zero) == 0)
+            {
+                if (nzero++ == 0)
+                    zerostart = offset;
+                continue;
+            }
+          if (nzero)
+            {
+                report (zerostart, "zeroed", "%lu zeroed record(s)", nzero);
+                nzero = 0;
+            }
+
+          if (utp->ut_type < 0 || utp->ut_type > UT_TYPE_MAX)
+            {
+                report (offset, "bad-type", "invalid ut_type %d",
+                        (int) utp->ut_type);
+                continue;
+            }
+
+          if (badstring (UT_USER (utp), sizeof (UT_USER (utp))))
+              report (offset, "garbage", "ut_user");
+          if (badstring (utp->ut_line, sizeof utp->ut_line))
+              report (offset, "garbage", "ut_line");
+          if (badstring (utp->ut_host, sizeof utp->ut_host))
+              report (offset, "garbage", "ut_host");
+
+          /* A time regression is legitimate after a system clock change:
+           * OLD_TIME holds the time before the change, NEW_TIME the time
+           * after it.  */
+          t = UT_TIME_MEMBER (utp);
+          if (utp->ut_type == NEW_TIME && timechange)
+              timechange = 0;
+          else
+            {
+                if (t < prevtime)
+                    report (offset, "time-regression",
+                            "%ld second(s) before the previous record",
+                            (long) (prevtime - t));
+                timechange = (utp->ut_type == OLD_TIME);
+            }
+          prevtime = t;
+      }
+    if (wtmpreader_error (&rd) < 0)
+        die (errno, "error while reading the wtmp file");
+
+    if (nzero)
+        report (zerostart, "zeroed", "%lu zeroed record(s)", nzero);
+
+    if (sb.st_size % checkrecsize)
+        report (sb.st_size - sb.st_size % checkrecsize, "truncated",
+                "partial trailing record of %lu byte(s)",
+                (unsigned long) (sb.st_size % checkrecsize));
+
+    if (format == CHECK_JSON)
+      {
+          printf ("{\"file\":");
+          jsonstring (wtmpfile);
+          printf (",\"layout\":");
+          jsonstring (rd.layout->name);
+          printf (",\"records\":%lu,\"problems\":%lu}\n", nrecords,
+                  nproblems);
+      }
+    else
+        printf ("%s: %lu record(s) checked (%s layout), "
+                "%lu problem(s) found.\n",
+                wtmpfile, nrecords, rd.layout->name, nproblems);
+
+    wtmpreader_close (&rd);
+
+    return nproblems;
+}
@@ -51,8 +51,10 @@
 # include <strings.h>
 #endif
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>             /* CHAR_MAX */
 #include <locale.h>             /* setlocale */
-#include <pwd.h>                /* getpwnam */
 #include <regex.h>
 #include <stdarg.h>
 #include <time.h>
@@ -78,6 +80,32 @@
 
 static const char *progname;
 
+/* Options without a short form */
+enum
+{
+    ANONYMIZE_OPTION = CHAR_MAX + 1,
+    BACKUP_OPTION,
+    BUILD_INDEX_OPTION,
+    CHECK_OPTION,
+    CONCURRENCY_OPTION,
+    DAEMON_OPTION,
+    DEDUP_OPTION,
+    DIFF_OPTION,
+    JOURNAL_OPTION,
+    MERGE_OPTION,
+    OUTPUT_OPTION,
+    OUTPUT_BINARY_OPTION,
+    PASSWD_OPTION,
+    PSEUDONYMIZE_OPTION,
+    QUERY_OPTION,
+    REBUILD_LASTLOG_OPTION,
+    REVERT_OPTION,
+    SPLIT_BY_OPTION,
+    STATS_TIMING_OPTION,
+    TAIL_OPTION,
+    TOP_OFFENDERS_OPTION
+};
+
 /*
  *	Get the basename of a filename
  */
@@ -104,13 +132,100 @@ usage (int status)
 #if defined(HAVE_UTMPXNAME) || defined(HAVE_UTMPNAME)
             " [-f <wtmpfile>]"
 #endif
-            " <user> [<fake>]",
+            " [--passwd=<file>]",
+        "                 [--backup[=<file>]] <user> [<fake>]",
+        "       " PACKAGE " -r --output-binary=<file>|- [-t <time>]"
+#if defined(HAVE_UTMPXNAME) || defined(HAVE_UTMPNAME)
+            " [-f <wtmpfile>]"
+#endif
+            " [<user>]",
+        "       " PACKAGE " --anonymize=<rules> [-f <wtmpfile>]"
+            " [--backup[=<file>]] [--journal=<journal>]",
+        "       " PACKAGE " --pseudonymize=<keyfile> [-f <wtmpfile>]"
+            " [--output=<file>|--journal=<journal>]",
+        "       " PACKAGE " --pseudonymize=<keyfile> <wtmpfile>...",
+        "       " PACKAGE " --merge=<file> [--dedup] <wtmpfile>...",
+        "       " PACKAGE " --split-by=hour|day|week|month [-f <wtmpfile>]"
+            " <outdir>",
+        "       " PACKAGE " --top-offenders[=<k>] [-f <btmpfile>]",
+        "       " PACKAGE " --concurrency[=hour|day|week|month]"
+            " [-f <wtmpfile>]",
+        "       " PACKAGE " --rebuild-lastlog[=<file>] [<wtmpfile>...]",
+        "       " PACKAGE " --build-index [-f <wtmpfile>]",
+        "       " PACKAGE " --check[=json] [-f <wtmpfile>]",
+        "       " PACKAGE " --diff <wtmpfile1> <wtmpfile2>",
+        "       " PACKAGE " --revert=<journal> [-f <wtmpfile>]",
+        "       " PACKAGE " --daemon=<socket> [-f <wtmpfile>]",
+        "       " PACKAGE " --query=<socket> [-l <user>|-r [<user>]]",
 #if defined(HAVE_UTMPXNAME) || defined(HAVE_UTMPNAME)
         "  -f, --file       Modify <wtmpfile> instead of " WTMP_FILE,
 #endif
         "  -l, --list       Show listing of <user> logins",
         "  -r, --raw        Show the raw content of the wtmp database",
-        "  -t, --time       Delete the login at the specified time",
+        "  -t, --time       Delete the login at the specified time (with -r,",
+        "                   show the records at the specified time)",
+        "      --anonymize=<rules>",
+        "                   Rewrite the host and the address of the records",
+        "                   matching the networks and domains in <rules>",
+        "      --backup[=<file>]",
+        "                   Copy <wtmpfile> to <file> (default: <wtmpfile>.bak)",
+        "                   before patching it",
+        "      --build-index",
+        "                   Create or update the index <wtmpfile>.idx used",
+        "                   to speed up the --list and --raw queries",
+        "      --check[=json]",
+        "                   Check the integrity of the wtmp database",
+        "      --concurrency[=hour|day|week|month]",
+        "                   Show the highest and the average number of the",
+        "                   sessions open in each hour, day (default), week",
+        "                   or month",
+        "      --daemon=<socket>",
+        "                   Keep the records and the sessions in memory and",
+        "                   answer the queries received on a UNIX socket",
+        "      --dedup      Drop the duplicate records while merging",
+        "      --diff       Show the records that differ in two wtmp files",
+        "      --journal=<journal>",
+        "                   Save the records to be patched in <journal>",
+        "                   instead of <wtmpfile>.undo; --anonymize and",
+        "                   --pseudonymize only keep this journal, which",
+        "                   holds the original names and addresses, if the",
+        "                   option is given",
+        "      --merge=<file>",
+        "                   Merge the wtmp files in time order into <file>",
+        "      --output=<file>",
+        "                   Write the pseudonymized records to <file>",
+        "                   instead of patching <wtmpfile>",
+        "      --output-binary=<file>|-",
+        "                   Write the records selected by --raw to <file> or",
+        "                   to the standard output as a wtmp file",
+        "      --passwd=<file>",
+        "                   Check the user names against <file> instead of",
+        "                   the system user database",
+        "      --pseudonymize=<keyfile>",
+        "                   Replace the user and host names of the login",
+        "                   records by tokens hashed with the key in <keyfile>",
+        "      --query=<socket>",
+        "                   Send the --list or --raw query (or a request for",
+        "                   statistics) to the daemon listening on <socket>",
+        "      --rebuild-lastlog[=<file>]",
+        "                   Update the last login of each user in the lastlog",
+        "                   <file> (default: " LASTLOG_FILE ") from the wtmp",
+        "                   files",
+        "      --revert=<journal>",
+        "                   Restore the records saved in the undo <journal>",
+        "      --split-by=hour|day|week|month",
+        "                   Copy the records of each period to its own file",
+        "                   <outdir>/<wtmpfile>-<period>",
+        "      --stats-timing[=json]",
+        "                   Print the performance counters and the time spent",
+        "                   in each phase to stderr",
+        "      --tail       Also read the records appended to <wtmpfile>",
+        "                   while it is scanned by --list, --raw, --check,",
+        "                   --concurrency or --top-offenders",
+        "      --top-offenders[=<k>]",
+        "                   Show the <k> (default: 10) sources and users with",
+        "                   the most login records, as the failed logins in",
+        "                   a btmp file",
         "",
         "Samples:",
 #if defined(HAVE_UTMPXNAME) || defined(HAVE_UTMPNAME)
@@ -118,6 +233,13 @@ usage (int status)
         "  ./" PACKAGE " -t \"2008.09.06 14:30:00\" jekyll hide",
         "  ./" PACKAGE " -t \"2013\\.12\\.?? 23:.*\" hide",
         "  ./" PACKAGE " -f " WTMP_FILE ".1 jekyll",
+        "  ./" PACKAGE " -f " WTMP_FILE ".1 --anonymize=/etc/wtmpclean.rules",
+        "  ./" PACKAGE " -f /var/log/btmp --top-offenders=20",
+        "  ./" PACKAGE " -r -t \"2013\\.12\\..*\" --output-binary=- |",
+        "      utmpdump /dev/stdin",
+        "  ./" PACKAGE " --concurrency=hour --tail",
+        "  ./" PACKAGE " --rebuild-lastlog " WTMP_FILE ".1 " WTMP_FILE,
+        "  ./" PACKAGE " --merge=/tmp/wtmp --dedup " WTMP_FILE ".1 " WTMP_FILE,
 #else
         "  ./" PACKAGE " root",
 #endif
@@ -154,18 +276,148 @@ die (int err_no, const char *fmt, ...)
     exit (EXIT_FAILURE);
 }
 
+static int statsformat;
+
+/* Print the performance counters (--stats-timing) when the program exits */
 static void
-userchk (const char *usr)
+statsreport (void)
 {
-    struct passwd *pw;
+    static const char *phases[WTMPSTATS_NPHASES] = {
+        NULL, "open", "scan", "pair", "liveness", "format", "write-back"
+    };
+    const struct wtmpstats *s = &wtmpstats;
+    int i;
+
+    wtmpstats_phase (WTMPSTATS_NONE);
+    fflush (stdout);
+
+    if (statsformat == CHECK_JSON)
+      {
+          fprintf (stderr, "{\"records\":{\"scanned\":%llu,\"matched\":%llu,"
+                   "\"written\":%llu},\"bytes\":{\"read\":%llu,"
+                   "\"written\":%llu},\"syscalls\":{\"read\":%llu,"
+                   "\"write\":%llu},\"regex\":%llu,\"timeconv\":%llu,"
+                   "\"allocs\":%llu,\"phases\":{",
+                   s->scanned, s->matched, s->written, s->bytesread,
+                   s->byteswritten, s->readcalls, s->writecalls,
+                   s->regexevals, s->timeconv, s->allocs);
+          for (i = 1; i < WTMPSTATS_NPHASES; i++)
+              fprintf (stderr, "%s\"%s\":{\"wall\":%.6f,\"cpu\":%.6f}",
+                       i > 1 ? "," : "", phases[i], s->wall[i], s->cpu[i]);
+          fprintf (stderr, "}}\n");
+          return;
+      }
 
-    if (usr && !(pw = getpwnam (usr)))
+    fprintf (stderr,
+             "%s: records: %llu scanned, %llu matched, %llu written\n"
+             "%s: bytes: %llu read, %llu written "
+             "(%llu read and %llu write calls)\n"
+             "%s: %llu regex evaluations, %llu time conversions, "
+             "%llu allocations\n",
+             progname, s->scanned, s->matched, s->written,
+             progname, s->bytesread, s->byteswritten, s->readcalls,
+             s->writecalls, progname, s->regexevals, s->timeconv, s->allocs);
+    for (i = 1; i < WTMPSTATS_NPHASES; i++)
+        fprintf (stderr, "%s: %-10s %10.6fs wall %10.6fs cpu\n",
+                 progname, phases[i], s->wall[i], s->cpu[i]);
+}
+
+static void
+userchk (const char *usr)
+{
+    if (usr && !usercache_known (usr))
       {
           fprintf (stderr, "%s: unknown/bad user `%s'\n", progname, usr);
           exit (EXIT_FAILURE);
       }
 }
 
+/* Write the records of 'user' whose time matches 'timepattern' (all if
+ * NULL) to 'output' ("-" for the standard output) as a wtmp file */
+static void
+rawcopy (const char *wtmpfile, const char *user, const char *timepattern,
+         const char *output)
+{
+    struct stat sb, osb;
+    unsigned long nrec;
+    int out = STDOUT_FILENO, rc;
+
+    if (strcmp (output, "-"))
+      {
+          /* Check before truncating it that 'output' is not 'wtmpfile' */
+          if ((out = open (output, O_WRONLY | O_CREAT, 0644)) < 0)
+              die (errno, "cannot open %s", output);
+          if (fstat (out, &osb) < 0 || stat (wtmpfile, &sb) < 0)
+              die (errno, "%s", wtmpfile);
+          if (osb.st_dev == sb.st_dev && osb.st_ino == sb.st_ino)
+              die (0, "%s: the output is the wtmp file", output);
+          if (S_ISREG (osb.st_mode) && ftruncate (out, 0) < 0)
+              die (errno, "cannot truncate %s", output);
+      }
+
+    fflush (stdout);
+    if ((rc = wtmpextract (wtmpfile, user, timepattern, out, &nrec)) < 0)
+        die (0, "cannot copy the records to %s: %s", output,
+             wtmpstrerror (rc));
+
+    if (out != STDOUT_FILENO)
+      {
+          if (close (out) < 0)
+              die (errno, "%s: write error", output);
+          printf ("%s: copied %lu record(s) to %s.\n",
+                  wtmpfile, nrec, output);
+      }
+}
+
+/* Return the WTMPSPLIT_* value of the period named 'arg', or 0 */
+static int
+periodarg (const char *arg)
+{
+    static const char *periods[] = { NULL, "day", "week", "month", "hour" };
+    int i;
+
+    for (i = WTMPSPLIT_DAY; i <= WTMPSPLIT_HOUR; i++)
+        if (!strcmp (arg, periods[i]))
+            return i;
+
+    return 0;
+}
+
+/* Save 'wtmpfile' to 'backup' (<wtmpfile>.bak if empty) before an edit */
+static void
+backupfile (const char *wtmpfile, char *backup)
+{
+    static const char *methods[] = {
+        "clone", "copy_file_range", "sendfile", "read/write"
+    };
+    int rc;
+
+    if (!*backup)
+      {
+          if ((backup = malloc (strlen (wtmpfile) + sizeof (".bak"))) == NULL)
+              die (errno, "out of memory");
+          sprintf (backup, "%s.bak", wtmpfile);
+      }
+    if ((rc = wtmpbackup (wtmpfile, backup)) < 0)
+        die (0, "cannot save %s to %s: %s",
+             wtmpfile, backup, wtmpstrerror (rc));
+    printf ("%s: saved to %s (%s).\n", wtmpfile, backup, methods[rc]);
+}
+
+/* Return 'journal', or <wtmpfile>.undo if NULL */
+static char *
+journalfile (const char *wtmpfile, char *journal)
+{
+    if (!journal)
+      {
+          if ((journal = malloc (strlen (wtmpfile) + sizeof (".undo"))) == NULL)
+              die (errno, "out of memory");
+          sprintf (journal, "%s.undo", wtmpfile);
+      }
+
+    return journal;
+}
+
 int
 main (int argc, char **argv)
 {
@@ -179,11 +431,21 @@ main (int argc, char **argv)
     getenv (WTMP_FILE) ? : WTMP_FILE;
 # endif
 #endif
-    char *user = NULL, *fake = NULL, *timepattern = ".*";;
-    unsigned char dump = 0, rawdump = 0, numeric = 0;
+    char *user = NULL, *fake = NULL, *timepattern = NULL;
+    unsigned char dump = 0, rawdump = 0, numeric = 0, buildindex = 0;
+    unsigned char dedup = 0;
+    int splitby = 0, concurrency = 0;
+    unsigned int topk = 0;
+    char *endp;
+    char *diff = NULL, *daemonsock = NULL, *querysock = NULL;
+    char *journal = NULL, *revert = NULL, *backup = NULL, *anonymize = NULL;
+    char *pseudonymize = NULL, *output = NULL, *merge = NULL;
+    char *lastlog = NULL, *outputbinary = NULL;
+    int check = -1;
 
     int opt_index = 0;
-    unsigned int cleanrec, cleanerr;
+    unsigned int cleanrec;
+    int rc;
 
     setlocale (LC_ALL, "C");
 
@@ -201,6 +463,28 @@ main (int argc, char **argv)
               {"raw", no_argument, 0, 'r'},
               {"time", required_argument, 0, 't'},
               {"help", no_argument, 0, 'h'},
+              {"anonymize", required_argument, 0, ANONYMIZE_OPTION},
+              {"backup", optional_argument, 0, BACKUP_OPTION},
+              {"build-index", no_argument, 0, BUILD_INDEX_OPTION},
+              {"check", optional_argument, 0, CHECK_OPTION},
+              {"concurrency", optional_argument, 0, CONCURRENCY_OPTION},
+              {"daemon", required_argument, 0, DAEMON_OPTION},
+              {"dedup", no_argument, 0, DEDUP_OPTION},
+              {"diff", required_argument, 0, DIFF_OPTION},
+              {"journal", required_argument, 0, JOURNAL_OPTION},
+              {"merge", required_argument, 0, MERGE_OPTION},
+              {"output", required_argument, 0, OUTPUT_OPTION},
+              {"output-binary", required_argument, 0, OUTPUT_BINARY_OPTION},
+              {"passwd", required_argument, 0, PASSWD_OPTION},
+              {"pseudonymize", required_argument, 0, PSEUDONYMIZE_OPTION},
+              {"query", required_argument, 0, QUERY_OPTION},
+              {"rebuild-lastlog", optional_argument, 0,
+               REBUILD_LASTLOG_OPTION},
+              {"revert", required_argument, 0, REVERT_OPTION},
+              {"split-by", required_argument, 0, SPLIT_BY_OPTION},
+              {"stats-timing", optional_argument, 0, STATS_TIMING_OPTION},
+              {"tail", no_argument, 0, TAIL_OPTION},
+              {"top-offenders", optional_argument, 0, TOP_OFFENDERS_OPTION},
               {0, 0, 0, 0}
           };
           static const char *options =
@@ -239,9 +523,300 @@ main (int argc, char **argv)
             case 't':
                 timepattern = optarg;
                 break;
+            case ANONYMIZE_OPTION:
+                anonymize = optarg;
+                break;
+            case BACKUP_OPTION:
+                backup = optarg ? optarg : "";
+                break;
+            case BUILD_INDEX_OPTION:
+                buildindex = 1;
+                break;
+            case CHECK_OPTION:
+                if (!optarg || !strcmp (optarg, "text"))
+                    check = CHECK_TEXT;
+                else if (!strcmp (optarg, "json"))
+                    check = CHECK_JSON;
+                else
+                    usage (EXIT_FAILURE);
+                break;
+            case CONCURRENCY_OPTION:
+                if (!optarg)
+                    concurrency = WTMPSPLIT_DAY;
+                else if ((concurrency = periodarg (optarg)) == 0)
+                    usage (EXIT_FAILURE);
+                break;
+            case DAEMON_OPTION:
+                daemonsock = optarg;
+                break;
+            case DEDUP_OPTION:
+                dedup = 1;
+                break;
+            case DIFF_OPTION:
+                diff = optarg;
+                break;
+            case JOURNAL_OPTION:
+                journal = optarg;
+                break;
+            case MERGE_OPTION:
+                merge = optarg;
+                break;
+            case OUTPUT_OPTION:
+                output = optarg;
+                break;
+            case OUTPUT_BINARY_OPTION:
+                outputbinary = optarg;
+                break;
+            case PASSWD_OPTION:
+                usercache_load (optarg);
+                break;
+            case PSEUDONYMIZE_OPTION:
+                pseudonymize = optarg;
+                break;
+            case QUERY_OPTION:
+                querysock = optarg;
+                break;
+            case REBUILD_LASTLOG_OPTION:
+                lastlog = optarg ? optarg : "";
+                break;
+            case REVERT_OPTION:
+                revert = optarg;
+                break;
+            case SPLIT_BY_OPTION:
+                if ((splitby = periodarg (optarg)) == 0)
+                    usage (EXIT_FAILURE);
+                break;
+            case STATS_TIMING_OPTION:
+                if (!optarg || !strcmp (optarg, "text"))
+                    statsformat = CHECK_TEXT;
+                else if (!strcmp (optarg, "json"))
+                    statsformat = CHECK_JSON;
+                else
+                    usage (EXIT_FAILURE);
+                if (!wtmpstats_enabled)
+                    atexit (statsreport);
+                wtmpstats_enabled = 1;
+                break;
+            case TAIL_OPTION:
+                wtmpreader_tail = 1;
+                break;
+            case TOP_OFFENDERS_OPTION:
+                topk = optarg ? strtoul (optarg, &endp, 10) : 10;
+                if ((optarg && *endp) || topk == 0 || topk > 100000)
+                    usage (EXIT_FAILURE);
+                break;
             }
       }
 
+    if (diff)
+      {
+          if (dump || rawdump || buildindex || check >= 0
+              || argc != optind + 1)
+              usage (EXIT_FAILURE);
+
+          exit (wtmpdiff (diff, argv[optind]) ? EXIT_FAILURE : EXIT_SUCCESS);
+      }
+
+    if (check >= 0)
+      {
+          if (dump || rawdump || buildindex || argc != optind)
+              usage (EXIT_FAILURE);
+
+          exit (wtmpcheck (wtmpfile, check) ? EXIT_FAILURE : EXIT_SUCCESS);
+      }
+
+    if (daemonsock)
+      {
+          if (dump || rawdump || buildindex || querysock || argc != optind)
+              usage (EXIT_FAILURE);
+
+          wtmpdaemon (wtmpfile, daemonsock);
+      }
+
+    if (querysock)
+      {
+          char request[DAEMON_MAXREQ + 1];
+
+          if (buildindex || argc > optind + 1 || (dump && argc != optind + 1)
+              || (!dump && !rawdump && argc != optind))
+              usage (EXIT_FAILURE);
+
+          user = (argc == optind + 1) ? argv[optind] : NULL;
+          if (user && (strlen (user) > sizeof (UT_USER ((STRUCT_UTMP *) 0))
+                       || strpbrk (user, " \t\r\n")))
+              die (0, "bad user name `%s'", user);
+
+          snprintf (request, sizeof request, "%s%s%s",
+                    dump ? "LIST" : rawdump ? "RAW" : "STATS",
+                    user ? " " : "", user ? user : "");
+          exit (wtmpquery (querysock, request) ? EXIT_FAILURE : EXIT_SUCCESS);
+      }
+
+    if (revert)
+      {
+          if (dump || rawdump || buildindex || argc != optind)
+              usage (EXIT_FAILURE);
+
+          if ((rc = wtmprevert (wtmpfile, revert, &cleanrec)) < 0)
+              die (0, "cannot revert %s (%u record(s) restored): %s",
+                   wtmpfile, cleanrec, wtmpstrerror (rc));
+          printf ("%s: restored %u block(s) from %s.\n",
+                  wtmpfile, cleanrec, revert);
+          exit (EXIT_SUCCESS);
+      }
+
+    if (anonymize)
+      {
+          struct wtmpanon *anon;
+          unsigned int line;
+
+          if (dump || rawdump || buildindex || argc != optind)
+              usage (EXIT_FAILURE);
+
+          if ((rc = wtmpanon_load (anonymize, &anon, &line)) < 0)
+              die (0, "%s:%u: %s", anonymize, line, wtmpstrerror (rc));
+          if (backup)
+              backupfile (wtmpfile, backup);
+          /* The journal would keep the addresses being scrubbed: there is
+             none unless asked for */
+          if ((rc = wtmpanon (wtmpfile, anon, journal, &cleanrec)) < 0)
+              die (0, "cannot anonymize %s: %s", wtmpfile, wtmpstrerror (rc));
+          wtmpanon_free (anon);
+          printf ("%s: anonymized %u block(s).\n", wtmpfile, cleanrec);
+          exit (EXIT_SUCCESS);
+      }
+
+    if (pseudonymize)
+      {
+          struct wtmppseudo *pseudo;
+          char **files = &wtmpfile;
+          int i, nfiles = 1;
+
+          if (dump || rawdump || buildindex || anonymize ||
+              (output && argc > optind))
+              usage (EXIT_FAILURE);
+          if (argc > optind)
+            {
+                files = argv + optind;
+                nfiles = argc - optind;
+            }
+          /* A named journal or backup is for a single file, and a copy
+             is not journaled */
+          if ((nfiles > 1 && (journal || (backup && *backup))) ||
+              (output && journal))
+              usage (EXIT_FAILURE);
+
+          if ((rc = wtmppseudo_load (pseudonymize, &pseudo)) < 0)
+              die (0, "%s: %s", pseudonymize, wtmpstrerror (rc));
+          for (i = 0; i < nfiles; i++)
+            {
+                const char *target = files[i];
+
+                /* The copy is patched in place.  The journal would keep the
+                   original names: there is none unless asked for. */
+                if (output)
+                  {
+                      if ((rc = wtmpbackup (files[i], output)) < 0)
+                          die (0, "cannot copy %s to %s: %s",
+                               files[i], output, wtmpstrerror (rc));
+                      target = output;
+                  }
+                else if (backup)
+                    backupfile (files[i], backup);
+                if ((rc = wtmppseudo (target, pseudo, output ? NULL : journal,
+                                      &cleanrec)) < 0)
+                    die (0, "cannot pseudonymize %s: %s",
+                         target, wtmpstrerror (rc));
+                printf ("%s: pseudonymized %u block(s).\n", target, cleanrec);
+            }
+          wtmppseudo_free (pseudo);
+          exit (EXIT_SUCCESS);
+      }
+
+    if (merge)
+      {
+          unsigned long nrec, ndup;
+
+          if (dump || rawdump || buildindex || argc == optind)
+              usage (EXIT_FAILURE);
+
+          if ((rc = wtmpmerge (merge, argv + optind, argc - optind,
+                               dedup ? WTMPMERGE_DEDUP : 0, &nrec, &ndup)) < 0)
+              die (0, "cannot merge into %s: %s", merge, wtmpstrerror (rc));
+          printf ("%s: merged %lu record(s) from %d file(s), "
+                  "%lu duplicate(s) dropped.\n",
+                  merge, nrec, argc - optind, ndup);
+          exit (EXIT_SUCCESS);
+      }
+    else if (dedup)
+        usage (EXIT_FAILURE);
+
+    if (topk)
+      {
+          if (dump || rawdump || buildindex || argc != optind)
+              usage (EXIT_FAILURE);
+
+          wtmptop (wtmpfile, topk);
+          exit (EXIT_SUCCESS);
+      }
+
+    if (concurrency)
+      {
+          if (dump || rawdump || buildindex || argc != optind)
+              usage (EXIT_FAILURE);
+
+          wtmpconcurrency (wtmpfile, concurrency);
+          exit (EXIT_SUCCESS);
+      }
+
+    if (lastlog)
+      {
+          char **files = &wtmpfile;
+          int nfiles = 1;
+
+          if (dump || rawdump || buildindex)
+              usage (EXIT_FAILURE);
+          if (argc > optind)
+            {
+                files = argv + optind;
+                nfiles = argc - optind;
+            }
+
+          wtmplastlog (*lastlog ? lastlog : NULL, files, nfiles);
+          exit (EXIT_SUCCESS);
+      }
+
+    if (splitby)
+      {
+          unsigned long nrec;
+          unsigned int nfiles;
+
+          if (dump || rawdump || buildindex || argc != optind + 1)
+              usage (EXIT_FAILURE);
+
+          if ((rc = wtmpsplit (wtmpfile, argv[optind], splitby,
+                               &nrec, &nfiles)) < 0)
+              die (0, "cannot split %s into %s (%u file(s) written): %s",
+                   wtmpfile, argv[optind], nfiles, wtmpstrerror (rc));
+          printf ("%s: split %lu record(s) into %u file(s) in %s.\n",
+                  wtmpfile, nrec, nfiles, argv[optind]);
+          exit (EXIT_SUCCESS);
+      }
+
+    if (buildindex)
+      {
+          unsigned long nrec, newrec;
+
+          if (dump || rawdump || argc != optind)
+              usage (EXIT_FAILURE);
+
+          if ((rc = wtmpindex_build (wtmpfile, &nrec, &newrec)) < 0)
+              die (0, "%s: %s", wtmpfile, wtmpstrerror (rc));
+          printf ("%s: indexed %lu record(s), %lu new.\n",
+                  wtmpfile, nrec, newrec);
+          exit (EXIT_SUCCESS);
+      }
+
     if (argc == optind + 1)
         user = argv[optind];
     else if (argc == optind + 2)
@@ -249,29 +824,46 @@ main (int argc, char **argv)
           user = argv[optind];
 
           fake = argv[optind + 1];
-          userchk (fake);
       }
     else if (!((argc == optind) && rawdump))
         usage (EXIT_FAILURE);
 
+    if (outputbinary && !rawdump)
+        usage (EXIT_FAILURE);
+
+    /* Resolve all the user names with a single batch of lookups */
+    {
+        const char *names[2];
+
+        names[0] = (dump || rawdump) ? NULL : user;
+        names[1] = fake;
+        usercache_resolve (names, 2);
+        userchk (fake);
+    }
+
     if (dump)
       {
           wtmpxdump (wtmpfile, user);
           exit (EXIT_SUCCESS);
       }
+    else if (rawdump && outputbinary)
+      {
+          rawcopy (wtmpfile, user, timepattern, outputbinary);
+          exit (EXIT_SUCCESS);
+      }
     else if (rawdump)
       {
-          wtmpxrawdump (wtmpfile, user);
+          wtmpxrawdump (wtmpfile, user, timepattern);
           exit (EXIT_SUCCESS);
       }
 
     userchk (user);
-    cleanrec = wtmpedit (wtmpfile, user, fake, timepattern, &cleanerr);
-    if (cleanerr > 0)
-      {
-          fprintf (stderr, "%s: cannot clean up %s\n", progname, wtmpfile);
-          exit (EXIT_FAILURE);
-      }
+    if (backup)
+        backupfile (wtmpfile, backup);
+    journal = journalfile (wtmpfile, journal);
+    if ((rc = wtmpedit (wtmpfile, user, fake, timepattern ? : ".*", journal,
+                        &cleanrec)) < 0)
+        die (0, "cannot clean up %s: %s", wtmpfile, wtmpstrerror (rc));
 
     if (fake)
         printf
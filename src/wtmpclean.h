@@ -133,35 +133,154 @@ typedef struct UTMP_STRUCT_NAME STRUCT_UTMP;
 #  define WTMP_FILE "/etc/wtmp"
 # endif
 
+# if !defined LASTLOG_FILE && defined _PATH_LASTLOG
+#  define LASTLOG_FILE _PATH_LASTLOG
+# endif
+
+# ifndef LASTLOG_FILE
+#  define LASTLOG_FILE "/var/log/lastlog"
+# endif
+
 #define SECINADAY (24*60*60)    /* seconds in a day */
 
-/* Types of listing */
-#define R_NONE        0
-#define R_CRASH       1         /* No logout record, system boot in between */
-#define R_DOWN        2         /* System brought down in decent way */
-#define R_NORMAL      3         /* Normal */
-#define R_NOW         4         /* Still logged in */
-#define R_REBOOT      5         /* Reboot record. */
-#define R_PHANTOM     6         /* No logout record but session is stale. */
-#define R_TIMECHANGE  7         /* NEW_TIME or OLD_TIME */
-
-/* Double linked list of struct UTMP_STRUCT_NAME's */
-struct utmpxlist
+/* Highest valid value of ut_type */
+# ifdef ACCOUNTING
+#  define UT_TYPE_MAX ACCOUNTING
+# else
+#  define UT_TYPE_MAX DEAD_PROCESS
+# endif
+
+#include "libwtmpclean.h"
+
+/* A record patched by wtmpedit(), as saved in the undo journal */
+struct wtmppatch
 {
-    STRUCT_UTMP ut;
-    time_t eos;                 /* end of session */
-    time_t delta;               /* time difference */
-    int ltype;                  /* R_NONE, R_CRASH, ... */
-    struct utmpxlist *prev, *next;
+    off_t offset;
+    STRUCT_UTMP orig, rec;
 };
 
+/* Update the performance counters: a test of a global flag when disabled.
+ * The counters are also updated by the threads of a partitioned edit.  */
+#ifdef __GNUC__
+# define STATS_ADD(counter, n) \
+    do { if (wtmpstats_enabled) \
+        __atomic_add_fetch (&wtmpstats.counter, (n), __ATOMIC_RELAXED); \
+    } while (0)
+#else
+# define STATS_ADD(counter, n) \
+    do { if (wtmpstats_enabled) wtmpstats.counter += (n); } while (0)
+#endif
+#define STATS_PHASE(phase) \
+    (wtmpstats_enabled ? wtmpstats_phase (phase) : WTMPSTATS_NONE)
+
+/* USDT probes of the provider "wtmpclean" (configure --enable-usdt): a nop
+ * instruction in the code when the probe is not attached.  When the probes
+ * are disabled the arguments are not even evaluated.  */
+#ifdef ENABLE_USDT
+# include <sys/sdt.h>
+# include <time.h>
+# define PROBE2(name, a, b) DTRACE_PROBE2 (wtmpclean, name, a, b)
+# define PROBE3(name, a, b, c) DTRACE_PROBE3 (wtmpclean, name, a, b, c)
+/* Monotonic clock in nanoseconds, for the latency arguments */
+static inline long long
+probeclock (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+# define PROBE_CLOCK() probeclock ()
+#else
+# define PROBE2(name, a, b) ((void) sizeof (a), (void) sizeof (b))
+# define PROBE3(name, a, b, c) \
+    ((void) sizeof (a), (void) sizeof (b), (void) sizeof (c))
+# define PROBE_CLOCK() 0LL
+#endif
+
+/* A read submitted to the io_uring shared by the readers (wtmpuring.c) */
+struct wtmpuringreq
+{
+    int fd;
+    char *buf;
+    size_t len;
+    off_t offset;
+    int done;                   /* set when the read is completed */
+    int res;                    /* number of bytes read, or -errno */
+    long long start;            /* submission time, for the read probe */
+};
+
+/* Buffered writer of a new file (wtmpio.c) */
+struct wtmpwriter
+{
+    int fd;
+    char *buf;
+    size_t len, size;
+    off_t offset;               /* file offset of buf[0] */
+};
+
+/* Methods of wtmpcopyrange() */
+#define WTMPCOPY_RANGE      0   /* copy_file_range(2) */
+#define WTMPCOPY_SPLICE     1   /* splice(2) */
+#define WTMPCOPY_READWRITE  2   /* pread(2) and write(2) */
+
+/* Flags of wtmpedit_apply() */
+#define WTMPEDIT_PARALLEL   1   /* the patch function can run in threads */
+
+/* Internal functions shared by the library modules */
+struct stat;
+struct wtmptime;
+int wtmpwrite (int fd, const void *data, size_t len);
+int wtmppwrite (int fd, const void *data, size_t len, off_t offset);
+uint64_t wtmphash (const void *data, size_t len);
+int wtmpaddrfield (const unsigned char *addr, int *family);
+int wtmpwriteback (int fd, const struct wtmppatch *patches, size_t npatches,
+                   unsigned int *written);
+int wtmpwriter_open (struct wtmpwriter *wr, int fd, size_t bufsize);
+int wtmpwriter_put (struct wtmpwriter *wr, const void *data, size_t len);
+int wtmpwriter_flush (struct wtmpwriter *wr);
+int wtmpwriter_close (struct wtmpwriter *wr);
+int wtmpcopyrange (int in, off_t offset, int out, size_t len, int *method);
+int wtmptime_compile (const char *pattern, struct wtmptime **tp);
+int wtmptime_match (const struct wtmptime *tp, time_t rawtime);
+void wtmptime_free (struct wtmptime *tp);
+int wtmpedit_apply (const char *wtmpfile,
+                    int (*patch) (const STRUCT_UTMP *utp, STRUCT_UTMP *rec,
+                                  void *arg), void *arg, int flags,
+                    const char *journal, unsigned int *cleanrec);
+int wtmpuring_get (void);
+void wtmpuring_put (void);
+int wtmpuring_submit (struct wtmpuringreq *req);
+int wtmpuring_wait (struct wtmpuringreq *req);
+int wtmpjournal_append (const char *journal, const struct stat *sb,
+                        const struct wtmppatch *patches, size_t npatches);
+
+/* Maximum length of a request sent to the query daemon */
+#define DAEMON_MAXREQ   128
+
+/* Output formats of the integrity checks */
+#define CHECK_TEXT      0
+#define CHECK_JSON      1
+
 void usage (int status);
 void wtmpxdump (const char *wtmpfile, const char *user);
-void wtmpxrawdump (const char *wtmpfile, const char *user);
-unsigned int wtmpedit (const char *wtmpfile, const char *user,
-                       const char *newuser, const char *timepattern,
-                       unsigned int *cleanerr);
-char *timetostr (const time_t time);
+void wtmpxrawdump (const char *wtmpfile, const char *user,
+                   const char *timepattern);
+unsigned long wtmpcheck (const char *wtmpfile, int format);
+unsigned long wtmpdiff (const char *wtmpfile1, const char *wtmpfile2);
+void dumpsession (FILE *stream, const struct utmpxlist *p, int what);
+void rawdumprecord (FILE *stream, const STRUCT_UTMP *utp);
+unsigned long wtmptop (const char *btmpfile, unsigned int k);
+unsigned long wtmpconcurrency (const char *wtmpfile, int period);
+void wtmplastlog (const char *lastlogfile, char *const *wtmpfiles,
+                  int nfiles);
+void wtmpdaemon (const char *wtmpfile, const char *sockpath)
+    __attribute__ ((noreturn));
+int wtmpquery (const char *sockpath, const char *request);
+void usercache_load (const char *passwdfile);
+void usercache_resolve (const char *const *names, size_t n);
+int usercache_known (const char *name);
+int usercache_uid (const char *name, uid_t *uid);
 void die (int err_no, const char *fmt, ...) __attribute__ ((noreturn));
 
 #undef __USE_GNU
@@ -0,0 +1,214 @@
+/*
+ * wtmpconcurrency.c -- Timeline of the concurrent sessions.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The records are fed to the pairing engine in file order, and every login
+ * and every end of a session is an event of a sweep line over the time.
+ * A session is closed by the record that ends it, so the events come in
+ * time order without being sorted or queued: the number of the sessions
+ * open only changes at a record.  For each bucket (an hour, a day, a week
+ * or a month, in local time) the sweep keeps the highest number of open
+ * sessions and the integral of that number over the time, which divided by
+ * the length of the bucket gives the average.  A time going backwards is
+ * taken as the time of the previous record.  The sessions closed are
+ * reused, so the memory depends on the number of the open ones only.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <errno.h>
+#include <time.h>
+
+#include "wtmpclean.h"
+
+struct sweep
+{
+    int period;
+    time_t start, end;          /* the bucket is [start, end) */
+    time_t from;                /* start of the time covered in the bucket */
+    time_t last;                /* time of the last event */
+    unsigned long open;         /* sessions open */
+    unsigned long max;          /* highest number of open sessions in the
+                                   bucket */
+    unsigned long peak;         /* highest number of open sessions */
+    time_t peaktime;
+    double area;                /* open sessions * seconds in the bucket */
+    struct utmpxlist *free;     /* closed sessions, linked by 'next' */
+    struct utmpxlist *all;      /* all the sessions, linked by 'prev' */
+};
+
+static void
+bucketstart (struct sweep *sw, time_t t)
+{
+    char suffix[32];
+
+    if (wtmpperiod (t, sw->period, &sw->start, &sw->end, suffix,
+                    sizeof suffix) < 0)
+        die (errno, "cannot convert the time %ld", (long) t);
+    sw->from = sw->last = t;
+    sw->max = sw->open;
+    sw->area = 0;
+}
+
+static void
+bucketprint (const struct sweep *sw, time_t end)
+{
+    double average = end > sw->from ? sw->area / (end - sw->from) : sw->open;
+
+    printf ("%-19s %8lu %10.2f\n", timetostr (sw->start), sw->max, average);
+}
+
+/* Move the sweep line to the time 't', printing the buckets left behind */
+static void
+advance (struct sweep *sw, time_t t)
+{
+    if (t < sw->last)
+        t = sw->last;
+
+    while (t >= sw->end)
+      {
+          sw->area += (double) sw->open * (sw->end - sw->last);
+          bucketprint (sw, sw->end);
+          bucketstart (sw, sw->end);
+      }
+    sw->area += (double) sw->open * (t - sw->last);
+    sw->last = t;
+}
+
+static void
+sessionclosed (struct utmpxlist *session, void *arg)
+{
+    struct sweep *sw = arg;
+
+    sw->open--;
+    session->next = sw->free;
+    sw->free = session;
+}
+
+/* Print the highest and the average number of the sessions open in each
+ * bucket of 'period' (one of the WTMPSPLIT_* values) of 'wtmpfile', in a
+ * single pass.  Return the number of the sessions.  */
+unsigned long
+wtmpconcurrency (const char *wtmpfile, int period)
+{
+    struct wtmpreader rd;
+    struct wtmppair *pair;
+    struct sweep sw;
+    struct utmpxlist *p, *prev;
+    STRUCT_UTMP *utp;
+    unsigned long nsessions = 0;
+    int rc;
+
+    STATS_PHASE (WTMPSTATS_OPEN);
+    if ((rc = wtmpreader_open (&rd, wtmpfile,
+                               WTMPREADER_ASYNC | WTMPREADER_MMAP |
+                               WTMPREADER_DONTNEED |
+                               (wtmpreader_tail ? WTMPREADER_TAIL : 0))) < 0)
+        die (0, "%s: %s", wtmpfile, wtmpstrerror (rc));
+    if ((pair = wtmppair_new ()) == NULL)
+        die (errno, "out of memory");
+
+    memset (&sw, 0, sizeof sw);
+    sw.period = period;
+    wtmppair_onclose (pair, sessionclosed, &sw);
+
+    printf ("%-19s %8s %10s\n", "start", "max", "average");
+
+    STATS_PHASE (WTMPSTATS_SCAN);
+    while ((utp = wtmpreader_next (&rd)) != NULL)
+      {
+          if (sw.end == 0)
+              bucketstart (&sw, UT_TIME_MEMBER (utp));
+          advance (&sw, UT_TIME_MEMBER (utp));
+
+          p = NULL;
+          if (utp->ut_type == USER_PROCESS)
+            {
+                if ((p = sw.free) != NULL)
+                    sw.free = p->next;
+                else
+                  {
+                      if ((p = malloc (sizeof (struct utmpxlist))) == NULL)
+                          die (errno, "out of memory");
+                      STATS_ADD (allocs, 1);
+                      p->prev = sw.all;
+                      sw.all = p;
+                  }
+            }
+
+          /* The sessions ended by the record are closed first */
+          if (wtmppair_feed (pair, utp, -1, p) < 0)
+              die (errno, "out of memory");
+          if (!p)
+              continue;
+
+          STATS_ADD (matched, 1);
+          nsessions++;
+          if (++sw.open > sw.max)
+              sw.max = sw.open;
+          if (sw.open > sw.peak)
+            {
+                sw.peak = sw.open;
+                sw.peaktime = sw.last;
+            }
+      }
+    if (wtmpreader_error (&rd) < 0)
+        die (errno, "error while reading %s", wtmpfile);
+    wtmpreader_close (&rd);
+
+    STATS_PHASE (WTMPSTATS_FORMAT);
+    if (sw.end)
+        bucketprint (&sw, sw.last);
+    printf ("\n%s: %lu session(s), %lu still open", wtmpfile, nsessions,
+            sw.open);
+    if (sw.peak)
+        printf (", peak of %lu at %s", sw.peak, timetostr (sw.peaktime));
+    printf ("\n");
+    fflush (stdout);
+    STATS_PHASE (WTMPSTATS_NONE);
+
+    wtmppair_free (pair);
+    for (p = sw.all; p; p = prev)
+      {
+          prev = p->prev;
+          free (p);
+      }
+
+    return nsessions;
+}
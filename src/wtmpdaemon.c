@@ -0,0 +1,590 @@
+/*
+ * wtmpdaemon.c -- Query daemon serving the wtmp lookups from memory.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The daemon loads the wtmp file once, pairs the sessions of all the users
+ * and keeps the records and the sessions in memory, in hash tables keyed by
+ * user name.  The file is checked every DAEMON_WATCH milliseconds and before
+ * each query: the appended records are paired incrementally, while a rotated,
+ * truncated or rewritten file is loaded again.  Only the appended records are
+ * read: an edit in place coming with an append is told by the generation of
+ * the file, bumped by wtmpclean's own edits, or else by a change of the last
+ * record loaded.
+ *
+ * Protocol: the client connects to the UNIX socket and sends one request
+ *
+ *   LIST <user>     the sessions of <user>, as printed by --list
+ *   RAW [<user>]    the records of <user> (or all), as printed by --raw
+ *   STATS           the state of the cache
+ *
+ * terminated by a newline.  The daemon answers with a status line, "OK" or
+ * "ERR <message>", followed by the output, and closes the connection.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wtmpclean.h"
+
+#define DAEMON_HASHSIZE  1021
+#define DAEMON_WATCH     1000   /* ms between two checks of the wtmp file */
+#define DAEMON_TIMEOUT   5      /* s granted to a client to send or read */
+
+/* Records and sessions of a user */
+struct cacheuser
+{
+    char name[sizeof (UT_USER ((STRUCT_UTMP *) 0))];
+    uint32_t *recs;             /* numbers of the records logging the user */
+    size_t nrecs, alloc;
+    struct utmpxlist *sessions, *last;
+    unsigned long nsessions;
+    struct cacheuser *next;
+};
+
+static struct
+{
+    const char *wtmpfile;
+    const struct wtmplayout *layout;
+    dev_t dev;
+    ino_t ino;
+    struct timespec ctime;
+    int64_t gen;                /* generation of the file (edits in place) */
+    STRUCT_UTMP *recs;
+    size_t nrecs, alloc;
+    struct cacheuser *users[DAEMON_HASHSIZE];
+    struct wtmppair *pair;      /* pairing state at the end of recs */
+    unsigned long nusers, nsessions;
+    time_t loaded;
+    unsigned long loads, updates, queries;
+} cache;
+
+static volatile sig_atomic_t stopping;
+
+static unsigned int
+namehash (const char *name, size_t len)
+{
+    unsigned int h = 0;
+    size_t i;
+
+    for (i = 0; i < len && name[i]; i++)
+        h = h * 31 + (unsigned char) name[i];
+
+    return h % DAEMON_HASHSIZE;
+}
+
+static struct cacheuser *
+userlookup (const char *name, size_t len, int create)
+{
+    struct cacheuser *u;
+    unsigned int h = namehash (name, len);
+
+    if (len > sizeof u->name)
+      {
+          if (!create)
+              return NULL;
+          len = sizeof u->name;
+      }
+    for (u = cache.users[h]; u; u = u->next)
+        if (!strncmp (u->name, name, len) &&
+            (len == sizeof u->name || !u->name[len]))
+            return u;
+    if (!create)
+        return NULL;
+
+    if ((u = calloc (1, sizeof (struct cacheuser))) == NULL)
+        die (errno, "out of memory");
+    strncpy (u->name, name, len);
+    u->next = cache.users[h];
+    cache.users[h] = u;
+    cache.nusers++;
+
+    return u;
+}
+
+static void
+cacheclear (void)
+{
+    struct cacheuser *u, *unext;
+    int i;
+
+    for (i = 0; i < DAEMON_HASHSIZE; i++)
+      {
+          for (u = cache.users[i]; u; u = unext)
+            {
+                unext = u->next;
+                wtmpsessions_free (u->sessions);
+                free (u->recs);
+                free (u);
+            }
+          cache.users[i] = NULL;
+      }
+
+    free (cache.recs);
+    cache.recs = NULL;
+    cache.nrecs = cache.alloc = 0;
+    cache.nusers = cache.nsessions = 0;
+    wtmppair_reset (cache.pair);
+}
+
+/* Store a record and pair it with the sessions loaded so far, as done by
+ * wtmpsessions() on a full scan.  */
+static void
+cacheadd (const STRUCT_UTMP *utp)
+{
+    struct cacheuser *u;
+    struct utmpxlist *p = NULL;
+
+    if (cache.nrecs == cache.alloc)
+      {
+          cache.alloc = cache.alloc ? 2 * cache.alloc : 4096;
+          cache.recs = realloc (cache.recs, cache.alloc * sizeof (STRUCT_UTMP));
+          if (cache.recs == NULL)
+              die (errno, "out of memory");
+      }
+    memcpy (&cache.recs[cache.nrecs], utp, sizeof (STRUCT_UTMP));
+
+    u = userlookup (UT_USER (utp), sizeof (UT_USER (utp)), 1);
+    if (u->nrecs == u->alloc)
+      {
+          u->alloc = u->alloc ? 2 * u->alloc : 16;
+          if ((u->recs = realloc (u->recs, u->alloc * sizeof (uint32_t)))
+              == NULL)
+              die (errno, "out of memory");
+      }
+    u->recs[u->nrecs++] = cache.nrecs++;
+
+    if (utp->ut_type == USER_PROCESS)
+      {
+          if ((p = malloc (sizeof (struct utmpxlist))) == NULL)
+              die (errno, "out of memory");
+          p->next = NULL;
+          p->prev = u->last;
+          if (u->last)
+              u->last->next = p;
+          else
+              u->sessions = p;
+          u->last = p;
+          u->nsessions++;
+          cache.nsessions++;
+      }
+    if (wtmppair_feed (cache.pair, utp,
+                       (off_t) (cache.nrecs - 1) * cache.layout->recsize,
+                       p) < 0)
+        die (errno, "out of memory");
+}
+
+/* Return 1 if the last loaded record is no longer found in 'rd', which
+ * is left after it */
+static int
+cachechanged (struct wtmpreader *rd)
+{
+    STRUCT_UTMP *utp;
+
+    if (cache.nrecs == 0)
+        return 0;
+
+    return (wtmpreader_seek (rd, (int64_t) (cache.nrecs - 1) *
+                             rd->layout->recsize) < 0 ||
+            (utp = wtmpreader_next (rd)) == NULL ||
+            memcmp (utp, &cache.recs[cache.nrecs - 1], sizeof (STRUCT_UTMP)));
+}
+
+/* Bring the cache up to date with the wtmp file */
+static void
+cacheupdate (void)
+{
+    struct wtmpreader rd;
+    struct stat sb;
+    STRUCT_UTMP *utp;
+    off_t offset;
+    int64_t gen;
+    int rc, reload;
+
+    /* Read before the records: an edit made meanwhile is seen next time */
+    gen = wtmpgeneration (cache.wtmpfile);
+    if (stat (cache.wtmpfile, &sb) < 0)
+        return;                 /* being rotated: keep the current data */
+
+    offset = cache.layout ? (off_t) cache.nrecs * cache.layout->recsize : 0;
+    reload = (!cache.layout || sb.st_dev != cache.dev ||
+              sb.st_ino != cache.ino || sb.st_size < offset ||
+              gen != cache.gen);
+    if (!reload && sb.st_size < offset + (off_t) cache.layout->recsize)
+      {
+          /* No new record: a change in place requires a new load */
+          if (sb.st_ctim.tv_sec == cache.ctime.tv_sec &&
+              sb.st_ctim.tv_nsec == cache.ctime.tv_nsec)
+              return;
+          reload = 1;
+      }
+
+    if ((rc = wtmpreader_open (&rd, cache.wtmpfile, 0)) < 0)
+      {
+          fprintf (stderr, "%s: %s\n", cache.wtmpfile, wtmpstrerror (rc));
+          return;
+      }
+
+    /* Records appended: check that the last loaded one is still there */
+    if (!reload)
+      {
+          reload = (rd.layout != cache.layout || cachechanged (&rd));
+          if (reload)
+              wtmpreader_seek (&rd, 0);
+      }
+
+    if (reload)
+      {
+          cacheclear ();
+          cache.layout = rd.layout;
+          cache.loads++;
+          cache.loaded = time (NULL);
+      }
+    else
+        cache.updates++;
+
+    while ((utp = wtmpreader_next (&rd)) != NULL)
+        cacheadd (utp);
+    if ((rc = wtmpreader_error (&rd)) < 0)
+        fprintf (stderr, "%s: %s\n", cache.wtmpfile, wtmpstrerror (rc));
+
+    /* The inode data describing the content just loaded */
+    if (fstat (rd.fd, &sb) == 0)
+      {
+          cache.dev = sb.st_dev;
+          cache.ino = sb.st_ino;
+          cache.ctime = sb.st_ctim;
+      }
+    cache.gen = gen;
+    wtmpreader_close (&rd);
+}
+
+static void
+answerlist (FILE *stream, const char *user)
+{
+    const struct cacheuser *u;
+    const struct utmpxlist *p;
+    int ltype;
+
+    if (!user || (u = userlookup (user, strlen (user), 0)) == NULL)
+        return;
+
+    for (p = u->sessions; p; p = p->next)
+      {
+          ltype = p->ltype;
+          if (ltype == R_NONE)
+            {
+                /* Is process still alive? */
+                if (p->ut.ut_pid > 0 && kill (p->ut.ut_pid, 0) != 0
+                    && errno == ESRCH)
+                    ltype = R_PHANTOM;
+                else
+                    ltype = R_NOW;
+            }
+          dumpsession (stream, p, ltype);
+      }
+}
+
+static void
+answerraw (FILE *stream, const char *user)
+{
+    const struct cacheuser *u;
+    size_t i;
+
+    if (!user)
+      {
+          for (i = 0; i < cache.nrecs; i++)
+              rawdumprecord (stream, &cache.recs[i]);
+          return;
+      }
+
+    if ((u = userlookup (user, strlen (user), 0)) == NULL)
+        return;
+    for (i = 0; i < u->nrecs; i++)
+        rawdumprecord (stream, &cache.recs[u->recs[i]]);
+}
+
+static void
+answerstats (FILE *stream)
+{
+    fprintf (stream, "file: %s\n", cache.wtmpfile);
+    fprintf (stream, "layout: %s\n",
+             cache.layout ? cache.layout->name : "none");
+    fprintf (stream, "records: %lu\n", (unsigned long) cache.nrecs);
+    fprintf (stream, "users: %lu\n", cache.nusers);
+    fprintf (stream, "sessions: %lu\n", cache.nsessions);
+    fprintf (stream, "loaded: %s\n", timetostr (cache.loaded));
+    fprintf (stream, "loads: %lu\n", cache.loads);
+    fprintf (stream, "updates: %lu\n", cache.updates);
+    fprintf (stream, "queries: %lu\n", cache.queries);
+}
+
+/* Read a request, terminated by a newline, from the client 'fd' */
+static int
+readrequest (int fd, char *req, size_t size)
+{
+    size_t len = 0;
+    ssize_t nread;
+    char *nl;
+
+    while (len < size - 1)
+      {
+          if ((nread = read (fd, req + len, size - 1 - len)) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+          if (nread == 0)
+              break;
+          len += nread;
+          req[len] = '\0';
+          if ((nl = strchr (req, '\n')) != NULL)
+            {
+                *nl = '\0';
+                return 0;
+            }
+      }
+    req[len] = '\0';
+
+    return (len > 0 && len < size - 1) ? 0 : -1;
+}
+
+static void
+serve (int fd)
+{
+    struct timeval tv = { DAEMON_TIMEOUT, 0 };
+    char req[DAEMON_MAXREQ + 1], *cmd, *arg, *save;
+    FILE *stream;
+
+    setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+
+    if ((stream = fdopen (fd, "w")) == NULL)
+      {
+          close (fd);
+          return;
+      }
+
+    if (readrequest (fd, req, sizeof req) < 0)
+      {
+          fprintf (stream, "ERR bad request\n");
+          fclose (stream);
+          return;
+      }
+
+    cmd = strtok_r (req, " \t\r", &save);
+    arg = cmd ? strtok_r (NULL, " \t\r", &save) : NULL;
+
+    cacheupdate ();
+    cache.queries++;
+
+    if (cmd && !strcmp (cmd, "LIST") && arg)
+      {
+          fprintf (stream, "OK\n");
+          answerlist (stream, arg);
+      }
+    else if (cmd && !strcmp (cmd, "RAW"))
+      {
+          fprintf (stream, "OK\n");
+          answerraw (stream, arg);
+      }
+    else if (cmd && !strcmp (cmd, "STATS") && !arg)
+      {
+          fprintf (stream, "OK\n");
+          answerstats (stream);
+      }
+    else
+        fprintf (stream, "ERR unknown request\n");
+
+    fclose (stream);
+}
+
+static void
+stop (int sig)
+{
+    stopping = sig;
+}
+
+static int
+sockaddr (struct sockaddr_un *sun, const char *sockpath)
+{
+    memset (sun, 0, sizeof (*sun));
+    sun->sun_family = AF_UNIX;
+    if (strlen (sockpath) >= sizeof sun->sun_path)
+        return -1;
+    strcpy (sun->sun_path, sockpath);
+
+    return 0;
+}
+
+/* Serve the queries on 'wtmpfile' received on the UNIX socket 'sockpath'
+ * until SIGINT or SIGTERM is received.  */
+void
+wtmpdaemon (const char *wtmpfile, const char *sockpath)
+{
+    struct sockaddr_un sun;
+    struct sigaction sa;
+    struct pollfd pfd;
+    struct stat sb;
+    int sock, fd;
+
+    if (sockaddr (&sun, sockpath) < 0)
+        die (0, "socket path too long: %s", sockpath);
+    if ((cache.pair = wtmppair_new ()) == NULL)
+        die (errno, "out of memory");
+
+    if ((sock = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+        die (errno, "cannot create the socket");
+    if (bind (sock, (struct sockaddr *) &sun, sizeof sun) < 0)
+      {
+          /* Replace the socket left behind by a daemon no longer running */
+          if (errno != EADDRINUSE || lstat (sockpath, &sb) < 0 ||
+              !S_ISSOCK (sb.st_mode) || (fd = socket (AF_UNIX, SOCK_STREAM,
+                                                      0)) < 0)
+              die (errno, "cannot bind to %s", sockpath);
+          if (connect (fd, (struct sockaddr *) &sun, sizeof sun) == 0)
+              die (0, "%s: a daemon is already running", sockpath);
+          close (fd);
+          if (unlink (sockpath) < 0 ||
+              bind (sock, (struct sockaddr *) &sun, sizeof sun) < 0)
+              die (errno, "cannot bind to %s", sockpath);
+      }
+    if (listen (sock, SOMAXCONN) < 0)
+        die (errno, "cannot listen on %s", sockpath);
+
+    memset (&sa, 0, sizeof sa);
+    sa.sa_handler = stop;
+    sigemptyset (&sa.sa_mask);
+    sigaction (SIGINT, &sa, NULL);
+    sigaction (SIGTERM, &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction (SIGPIPE, &sa, NULL);
+
+    cache.wtmpfile = wtmpfile;
+    cacheupdate ();
+    if (!cache.layout)
+      {
+          unlink (sockpath);
+          die (0, "cannot load %s", wtmpfile);
+      }
+    fprintf (stderr, "%s: %lu record(s) loaded, listening on %s\n",
+             wtmpfile, (unsigned long) cache.nrecs, sockpath);
+
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    while (!stopping)
+      {
+          switch (poll (&pfd, 1, DAEMON_WATCH))
+            {
+            case -1:
+                if (errno != EINTR)
+                  {
+                      unlink (sockpath);
+                      die (errno, "poll failed");
+                  }
+                break;
+            case 0:
+                cacheupdate ();
+                break;
+            default:
+                if ((fd = accept (sock, NULL, NULL)) >= 0)
+                    serve (fd);
+                break;
+            }
+      }
+
+    close (sock);
+    unlink (sockpath);
+    cacheclear ();
+    wtmppair_free (cache.pair);
+
+    exit (EXIT_SUCCESS);
+}
+
+/* Send 'request' to the daemon listening on 'sockpath' and copy its answer
+ * to the standard output.  Return 0 on success, -1 on error.  */
+int
+wtmpquery (const char *sockpath, const char *request)
+{
+    struct sockaddr_un sun;
+    char buf[BUFSIZ];
+    FILE *stream;
+    int fd;
+
+    if (sockaddr (&sun, sockpath) < 0)
+        die (0, "socket path too long: %s", sockpath);
+    if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+        die (errno, "cannot create the socket");
+    if (connect (fd, (struct sockaddr *) &sun, sizeof sun) < 0)
+        die (errno, "cannot connect to %s", sockpath);
+
+    if (write (fd, request, strlen (request)) < 0 || write (fd, "\n", 1) < 0)
+        die (errno, "cannot send the request to %s", sockpath);
+    if ((stream = fdopen (fd, "r")) == NULL)
+        die (errno, "fdopen failed");
+
+    if (fgets (buf, sizeof buf, stream) == NULL)
+        buf[0] = '\0';
+    if (strcmp (buf, "OK\n"))
+      {
+          buf[strcspn (buf, "\n")] = '\0';
+          fprintf (stderr, "%s: %s\n", sockpath,
+                   strncmp (buf, "ERR ", 4) ? "bad answer" : buf + 4);
+          fclose (stream);
+          return -1;
+      }
+
+    while (fgets (buf, sizeof buf, stream) != NULL)
+        fputs (buf, stdout);
+    fclose (stream);
+
+    return 0;
+}
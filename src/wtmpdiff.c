@@ -0,0 +1,245 @@
+/*
+ * wtmpdiff.c -- Record-level comparison of two wtmp files.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "wtmpclean.h"
+
+/* Number of records compared with a single memcmp */
+#define DIFF_NREC  2048
+
+#define FIELD(name, member) \
+    { name, offsetof (STRUCT_UTMP, member), sizeof (((STRUCT_UTMP *) 0)->member) }
+
+static const struct
+{
+    const char *name;
+    size_t offset, size;
+} fields[] = {
+    FIELD ("type", ut_type),
+    FIELD ("pid", ut_pid),
+    FIELD ("line", ut_line),
+    FIELD ("id", ut_id),
+#if HAVE_STRUCT_UTMPX_UT_NAME || HAVE_STRUCT_UTMP_UT_NAME
+    FIELD ("user", ut_name),
+#else
+    FIELD ("user", ut_user),
+#endif
+    FIELD ("host", ut_host),
+#ifdef __GLIBC__
+    FIELD ("exit", ut_exit),
+    FIELD ("session", ut_session),
+#endif
+    FIELD ("time", ut_tv),
+#ifdef HAVE_UTP_UT_ADDR_V6
+    FIELD ("addr", ut_addr_v6),
+#endif
+    { NULL, 0, 0 }
+};
+
+/* Fill 'buf' with up to 'len' bytes; return the number of bytes read */
+static size_t
+readblock (int fd, char *buf, size_t len, const char *path)
+{
+    size_t done = 0;
+    ssize_t nread;
+
+    while (done < len)
+      {
+          if ((nread = read (fd, buf + done, len - done)) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                die (errno, "error while reading %s", path);
+            }
+          if (nread == 0)
+              break;
+          done += nread;
+      }
+
+    return done;
+}
+
+static const char *diffname1, *diffname2;
+static const struct wtmplayout *difflayout;
+static unsigned long ndiff;
+
+static void
+diffheader (void)
+{
+    if (ndiff++ == 0)
+        printf ("--- %s\n+++ %s\n", diffname1, diffname2);
+}
+
+/* Return the record at 'raw', decoded if it has a foreign layout */
+static const STRUCT_UTMP *
+decoded (const char *raw, STRUCT_UTMP *dec)
+{
+    if (!raw)
+        return NULL;
+    if (!difflayout->decode)
+        return (const STRUCT_UTMP *) raw;
+
+    difflayout->decode (raw, 1, dec);
+    return dec;
+}
+
+static void
+diffrecord (unsigned long recno, const char *rawa, const char *rawb)
+{
+    STRUCT_UTMP deca, decb;
+    const STRUCT_UTMP *a = decoded (rawa, &deca), *b = decoded (rawb, &decb);
+    const char *pa = (const char *) a, *pb = (const char *) b;
+    int i, nfields = 0;
+
+    diffheader ();
+    printf ("@@ record %lu, offset %lld:", recno,
+            (long long) recno * difflayout->recsize);
+    if (a && b)
+        for (i = 0; fields[i].name; i++)
+            if (memcmp (pa + fields[i].offset, pb + fields[i].offset,
+                        fields[i].size))
+              {
+                  printf (" %s", fields[i].name);
+                  nfields++;
+              }
+    if (a && b && nfields == 0)
+        printf (" (unused bytes)");
+    putchar ('\n');
+
+    if (a)
+      {
+          printf ("- ");
+          rawdumprecord (stdout, a);
+      }
+    if (b)
+      {
+          printf ("+ ");
+          rawdumprecord (stdout, b);
+      }
+}
+
+/* Compare two wtmp files record by record.  Blocks of records are compared
+ * with memcmp and only the differing records are decoded and printed.
+ * Return the number of differing records.  */
+unsigned long
+wtmpdiff (const char *wtmpfile1, const char *wtmpfile2)
+{
+    const struct wtmplayout *layout2;
+    unsigned long recno = 0;
+    size_t recsize, blksize, len1, len2, nrec1, nrec2, tail1, tail2, i;
+    struct stat sb;
+    char *buf1, *buf2;
+    int fd1, fd2;
+
+    if ((fd1 = open (wtmpfile1, O_RDONLY)) < 0)
+        die (errno, "cannot open %s", wtmpfile1);
+    if ((fd2 = open (wtmpfile2, O_RDONLY)) < 0)
+        die (errno, "cannot open %s", wtmpfile2);
+
+    if (fstat (fd1, &sb) < 0)
+        die (errno, "cannot get file status");
+    difflayout = wtmplayout_probe (fd1, sb.st_size);
+    if (fstat (fd2, &sb) < 0)
+        die (errno, "cannot get file status");
+    layout2 = wtmplayout_probe (fd2, sb.st_size);
+    if (sb.st_size > 0 && layout2 != difflayout)
+        die (0, "%s and %s have different layouts (%s, %s)",
+             wtmpfile1, wtmpfile2, difflayout->name, layout2->name);
+
+    recsize = difflayout->recsize;
+    blksize = DIFF_NREC * recsize;
+    if ((buf1 = malloc (blksize)) == NULL ||
+        (buf2 = malloc (blksize)) == NULL)
+        die (errno, "out of memory");
+
+    diffname1 = wtmpfile1;
+    diffname2 = wtmpfile2;
+    ndiff = 0;
+
+    do
+      {
+          len1 = readblock (fd1, buf1, blksize, wtmpfile1);
+          len2 = readblock (fd2, buf2, blksize, wtmpfile2);
+
+          if (len1 == len2 && memcmp (buf1, buf2, len1) == 0)
+            {
+                recno += len1 / recsize;
+                continue;
+            }
+
+          nrec1 = len1 / recsize;
+          nrec2 = len2 / recsize;
+          for (i = 0; i < nrec1 || i < nrec2; i++, recno++)
+            {
+                const char *a = (i < nrec1) ? buf1 + i * recsize : NULL;
+                const char *b = (i < nrec2) ? buf2 + i * recsize : NULL;
+
+                if (a && b && memcmp (a, b, recsize) == 0)
+                    continue;
+
+                diffrecord (recno, a, b);
+            }
+
+          tail1 = len1 % recsize;
+          tail2 = len2 % recsize;
+          if (tail1 != tail2 ||
+              memcmp (buf1 + len1 - tail1, buf2 + len2 - tail2, tail1))
+            {
+                diffheader ();
+                printf ("@@ partial trailing records: %lu and %lu byte(s)\n",
+                        (unsigned long) tail1, (unsigned long) tail2);
+            }
+      }
+    while (len1 == blksize || len2 == blksize);
+
+    close (fd1);
+    close (fd2);
+    free (buf1);
+    free (buf2);
+
+    return ndiff;
+}
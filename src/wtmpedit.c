@@ -46,96 +46,797 @@
 #endif
 
 #include <errno.h>
+#include <fcntl.h>
 #include <regex.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <time.h>
 #include <unistd.h>
 #include <utime.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #include "wtmpclean.h"
 
-unsigned int
-wtmpedit (const char *wtmpfile, const char *user, const char *fake,
-          const char *timepattern, unsigned int *cleanerr)
+/* Number of records of a partition of a parallel edit, at least */
+#define EDIT_PARTREC    65536
+
+/* Number of partitions of a parallel edit, at most */
+#define EDIT_MAXPARTS   16
+
+/* Number of records read again with a single pread(2) under the lock */
+#define REFRESH_NREC    1024
+
+/* Format the date 'rawtime' in 's', of at least 20 bytes */
+static char *
+timeformat (const time_t rawtime, char *s)
 {
-    STRUCT_UTMP *utp;
-    unsigned int cleanrec;
-    int rc;
-    struct stat sb;
-    struct utimbuf currtime;
-    uid_t owner;
-    gid_t group;
+    struct tm tminfo;
+
+    STATS_ADD (timeconv, 1);
+    if (rawtime != 0)
+      {
+          localtime_r (&rawtime, &tminfo);
+          strftime (s, 20, "%Y.%m.%d %H:%M:%S", &tminfo);
+      }
+    else
+        s[0] = '\0';
+
+    return s;
+}
+
+/* Return the date 'rawtime' formatted as the raw dump and as the strings
+ * matched by the time patterns: "2008.09.06 14:30:00" */
+char *
+timetostr (const time_t rawtime)
+{
+    static char s[20];          /* [2008.09.06 14:30:00] */
+
+    return timeformat (rawtime, s);
+}
+
+/*
+ * The time patterns are usually made of digits, escaped dots, '.' and '?',
+ * like "2013\.12\.?? 23:.*", and they are always matched against a string
+ * of fixed layout.  Such a pattern is compiled into the list of the 24-byte
+ * images of the time string it can match, with a mask of the significant
+ * bytes: one image for each position of the match and each choice of the
+ * optional tokens, less the ones that conflict with the layout.  A record
+ * is then tested with three masked 64-bit compares per image, without
+ * strftime and regexec, or not tested at all if an image has no significant
+ * byte (".*").  The other patterns go through regexec.
+ */
+
+/* Layout of the time string: 'd' stands for a digit */
+static const char timelayout[] = "dddd.dd.dd dd:dd:dd";
+#define TIMELEN  (sizeof (timelayout) - 1)
+
+#define TIMEMATCH_MAXTOK   TIMELEN
+#define TIMEMATCH_MAXOPT   4
+#define TIMEMATCH_MAXCAND  32
+
+struct timematch
+{
+    int fast;                   /* the images below can be used */
+    int matchall;               /* one of them matches any time */
+    int matchempty;             /* the pattern matches the null time */
+    size_t ncand;
+    struct
+    {
+        uint64_t mask[3], value[3];
+    } cand[TIMEMATCH_MAXCAND];
+};
+
+/* Add the image of the tokens 'tok' (0 for any character) placed at
+ * 'start' in the time string, unless they cannot match there.  Return -1
+ * if there are too many images.  */
+static int
+timematch_add (struct timematch *m, const char *tok, size_t ntok,
+               size_t start)
+{
+    unsigned char mask[24], value[24];
+    size_t i;
+
+    memset (mask, 0, sizeof mask);
+    memset (value, 0, sizeof value);
+    for (i = 0; i < ntok; i++)
+      {
+          if (!tok[i])
+              continue;
+          if (timelayout[start + i] == 'd' ? !(tok[i] >= '0' && tok[i] <= '9')
+              : tok[i] != timelayout[start + i])
+              return 0;
+          mask[start + i] = 0xff;
+          value[start + i] = tok[i];
+      }
+
+    if (m->ncand == TIMEMATCH_MAXCAND)
+        return -1;
+    memcpy (m->cand[m->ncand].mask, mask, sizeof mask);
+    memcpy (m->cand[m->ncand].value, value, sizeof value);
+    for (i = 0; i < m->ncand; i++)
+        if (memcmp (&m->cand[i], &m->cand[m->ncand], sizeof m->cand[i]) == 0)
+            return 0;
+    for (i = 0; i < sizeof mask && !mask[i]; i++)
+        ;
+    if (i == sizeof mask)
+        m->matchall = 1;
+    m->ncand++;
+
+    return 0;
+}
+
+/* Compile 'pattern' for timematch_exec.  A pattern that is not made of
+ * literal digits, spaces, colons and dots, of '.' and of optional ('?')
+ * tokens, possibly anchored and followed by ".*", is left to 'regex'.  */
+static void
+timematch_compile (struct timematch *m, const char *pattern,
+                   const regex_t *regex)
+{
+    char tok[TIMEMATCH_MAXTOK], seq[TIMEMATCH_MAXTOK];
+    size_t opt[TIMEMATCH_MAXOPT];
+    size_t ntok = 0, nopt = 0, nseq, i, j, start, first, last;
+    unsigned int choice;
+    int bol = 0, eol = 0;
+    const char *p = pattern;
+
+    memset (m, 0, sizeof (struct timematch));
+    m->matchempty = (regexec (regex, "", (size_t) 0, NULL, 0) == 0);
+
+    if (*p == '^')
+      {
+          bol = 1;
+          p++;
+      }
+    while (*p)
+      {
+          if (p[0] == '.' && p[1] == '*' && (!p[2] || !strcmp (p + 2, "$")))
+              break;
+          if (p[0] == '$' && !p[1])
+            {
+                eol = 1;
+                break;
+            }
+          if (ntok == TIMEMATCH_MAXTOK)
+              return;
+          if (p[0] == '\\' && p[1] == '.')
+            {
+                tok[ntok++] = '.';
+                p += 2;
+            }
+          else if (*p == '.')
+            {
+                tok[ntok++] = 0;
+                p++;
+            }
+          else if ((*p >= '0' && *p <= '9') || *p == ' ' || *p == ':')
+              tok[ntok++] = *p++;
+          else
+              return;
+
+          /* "x??" is the same as "x?" */
+          if (*p == '?')
+            {
+                if (nopt == TIMEMATCH_MAXOPT)
+                    return;
+                opt[nopt++] = ntok - 1;
+                while (*p == '?')
+                    p++;
+            }
+      }
+
+    for (choice = 0; choice < (1U << nopt); choice++)
+      {
+          /* The optional tokens whose bit is set are left out */
+          for (i = j = nseq = 0; i < ntok; i++)
+            {
+                if (j < nopt && opt[j] == i)
+                    if (choice & (1U << j++))
+                        continue;
+                seq[nseq++] = tok[i];
+            }
+          if (nseq > TIMELEN)
+              continue;
+          first = eol ? TIMELEN - nseq : 0;
+          last = bol ? 0 : TIMELEN - nseq;
+          for (start = first; start <= last; start++)
+              if (timematch_add (m, seq, nseq, start) < 0)
+                  return;
+      }
+
+    m->fast = 1;
+}
+
+static inline void
+putdigits (char *p, int n, int v)
+{
+    while (n-- > 0)
+      {
+          p[n] = '0' + v % 10;
+          v /= 10;
+      }
+}
+
+/* Return 1 if the time 'rawtime', formatted by timetostr, matches 'regex' */
+static int
+timematch_regexec (const regex_t *regex, time_t rawtime)
+{
+    /* The time string is not static: the records of a parallel edit are
+       matched in several threads */
+    char s[20];
+
+    STATS_ADD (regexevals, 1);
+    return !regexec (regex, timeformat (rawtime, s), (size_t) 0, NULL, 0);
+}
+
+/* Return 1 if the time 'rawtime', formatted by timetostr, matches */
+static int
+timematch_exec (const struct timematch *m, const regex_t *regex,
+                time_t rawtime)
+{
+    struct tm tminfo;
+    uint64_t w[3];
+    char s[24];
+    size_t i;
+
+    if (!m->fast)
+        return timematch_regexec (regex, rawtime);
+    if (rawtime == 0)
+        return m->matchempty;
+    if (m->matchall)
+        return 1;
+
+    STATS_ADD (timeconv, 1);
+    localtime_r (&rawtime, &tminfo);
+    if (tminfo.tm_year < 1000 - 1900 || tminfo.tm_year > 9999 - 1900)
+        return timematch_regexec (regex, rawtime);
+
+    memcpy (s, timelayout, sizeof timelayout);
+    memset (s + TIMELEN, 0, sizeof s - TIMELEN);
+    putdigits (s, 4, tminfo.tm_year + 1900);
+    putdigits (s + 5, 2, tminfo.tm_mon + 1);
+    putdigits (s + 8, 2, tminfo.tm_mday);
+    putdigits (s + 11, 2, tminfo.tm_hour);
+    putdigits (s + 14, 2, tminfo.tm_min);
+    putdigits (s + 17, 2, tminfo.tm_sec);
+    memcpy (w, s, sizeof w);
+
+    for (i = 0; i < m->ncand; i++)
+        if ((w[0] & m->cand[i].mask[0]) == m->cand[i].value[0] &&
+            (w[1] & m->cand[i].mask[1]) == m->cand[i].value[1] &&
+            (w[2] & m->cand[i].mask[2]) == m->cand[i].value[2])
+            return 1;
+
+    return 0;
+}
+
+struct wtmptime
+{
+    struct timematch match;
     regex_t regex;
-    char msgbuf[100];
+};
+
+/* Compile the time pattern 'pattern' into '*tp'.  Return 0 or a WTMP_E*
+ * error code.  */
+int
+wtmptime_compile (const char *pattern, struct wtmptime **tp)
+{
+    struct wtmptime *t;
 
-    if (rc = regcomp (&regex, timepattern, REG_EXTENDED | REG_NOSUB))
+    if ((t = malloc (sizeof (struct wtmptime))) == NULL)
+        return WTMP_ESYS;
+    if (regcomp (&t->regex, pattern, REG_EXTENDED | REG_NOSUB))
       {
-          regerror (rc, &regex, msgbuf, sizeof (msgbuf));
-          die (0, "regcomp() failed: %s", msgbuf);
+          free (t);
+          return WTMP_EREGEX;
       }
+    timematch_compile (&t->match, pattern, &t->regex);
+    *tp = t;
 
-    if (lstat (wtmpfile, &sb) == -1)
-        die (errno, "cannot get file status");
-    if (!S_ISREG (sb.st_mode))
-        die (errno, "the wtmp file is not a regular file");
+    return 0;
+}
 
-    if (stat (wtmpfile, &sb) == -1)
-        die (errno, "cannot get file status");
-    currtime.actime = sb.st_atime;
-    currtime.modtime = sb.st_mtime;
-    owner = sb.st_uid;
-    group = sb.st_gid;
+/* Return 1 if the time 'rawtime' matches the pattern 'tp' */
+int
+wtmptime_match (const struct wtmptime *tp, time_t rawtime)
+{
+    return timematch_exec (&tp->match, &tp->regex, rawtime);
+}
+
+void
+wtmptime_free (struct wtmptime *tp)
+{
+    if (!tp)
+        return;
+    regfree (&tp->regex);
+    free (tp);
+}
+
+/*
+ * The records of a large file are scanned in partitions of whole records,
+ * by as many threads if the patch function allows it.  Each partition has
+ * its own reader, reading the file and not mapping it since it can be
+ * truncated under the scan, and collects the patched records of its
+ * partition in the order of the offsets: the lists of the
+ * partitions put one after the other make the list of a sequential scan,
+ * that is journaled as a whole.  The partitions being disjoint ranges of
+ * the file, their records are then written back by the threads in
+ * parallel.
+ *
+ * The login daemons keep appending to the file while it is scanned, so the
+ * scan reads a snapshot of the file without locking it.  Only the range of
+ * the patched records is locked, at the time they are written back, and a
+ * record changed since the scan (by another edit) is patched again.
+ */
 
-    UTMP_NAME_FUNCTION (wtmpfile);
-    SET_UTMP_ENT ();
+struct editpart
+{
+    struct wtmpreader rd;       /* positioned at the start of the partition */
+    size_t nrec;                /* number of records of the partition */
+    int (*patch) (const STRUCT_UTMP *utp, STRUCT_UTMP *rec, void *arg);
+    void *arg;
+    struct wtmppatch *patches;
+    size_t npatches;
+    int fd;                     /* the file written back */
+    unsigned int written;
+    int rc, err;                /* WTMP_E* code and errno of a failure */
+};
 
-    errno = 0;
-    cleanrec = *cleanerr = 0;
-    while ((utp = GET_UTMP_ENT ()))
+/* Collect the patched records of the partition 'arg' */
+static void *
+editscan (void *arg)
+{
+    struct editpart *p = arg;
+    struct wtmppatch *more;
+    STRUCT_UTMP *utp;
+    size_t alloc = 0;
+
+    for (; p->nrec > 0 && (utp = wtmpreader_next (&p->rd)) != NULL;
+         p->nrec--)
       {
-          if (utp->ut_type == USER_PROCESS &&
-              strncmp (UT_USER (utp), user, sizeof (UT_USER (utp))) == 0)
+          if (p->npatches == alloc)
             {
-                if (regexec
-                    (&regex, timetostr (UT_TIME_MEMBER (utp)), (size_t) 0, NULL,
-                     0))
+                alloc = alloc ? 2 * alloc : 64;
+                if ((more = realloc (p->patches, alloc * sizeof (*more)))
+                    == NULL)
+                  {
+                      p->rc = WTMP_ESYS;
+                      p->err = errno;
+                      return NULL;
+                  }
+                p->patches = more;
+                STATS_ADD (allocs, 1);
+            }
+          if (!p->patch (utp, &p->patches[p->npatches].rec, p->arg))
+              continue;
+
+          STATS_ADD (matched, 1);
+          PROBE2 (match, (long long) wtmpreader_tell (&p->rd),
+                  (int) utp->ut_type);
+          p->patches[p->npatches].offset = wtmpreader_tell (&p->rd);
+          memcpy (&p->patches[p->npatches].orig, utp, sizeof (STRUCT_UTMP));
+          p->npatches++;
+      }
+    p->rc = wtmpreader_error (&p->rd);
+    p->err = errno;
+
+    return NULL;
+}
+
+/* Write back the patched records of the partition 'arg' */
+static void *
+editwrite (void *arg)
+{
+    struct editpart *p = arg;
+
+    p->rc = wtmpwriteback (p->fd, p->patches, p->npatches, &p->written);
+    p->err = errno;
+
+    return NULL;
+}
+
+/* Return the number of partitions of a parallel edit of 'size' bytes */
+static int
+editnparts (off_t size)
+{
+#ifdef HAVE_PTHREAD
+    long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+    off_t n = size / ((off_t) EDIT_PARTREC * sizeof (STRUCT_UTMP));
+
+    if (ncpu > EDIT_MAXPARTS)
+        ncpu = EDIT_MAXPARTS;
+    if (n > ncpu)
+        n = ncpu;
+    return n > 1 ? (int) n : 1;
+#else
+    (void) size;
+    return 1;
+#endif
+}
+
+/* Run 'fn' on each of the 'nparts' partitions 'parts', in parallel when
+ * possible.  The first partition is run by the calling thread.  */
+static void
+editrun (void *(*fn) (void *), struct editpart *parts, int nparts)
+{
+    int i;
+#ifdef HAVE_PTHREAD
+    pthread_t threads[EDIT_MAXPARTS];
+    int started[EDIT_MAXPARTS];
+
+    for (i = 1; i < nparts; i++)
+        started[i] = !pthread_create (&threads[i], NULL, fn, &parts[i]);
+    fn (&parts[0]);
+    for (i = 1; i < nparts; i++)
+        if (started[i])
+            pthread_join (threads[i], NULL);
+        else
+            fn (&parts[i]);
+#else
+    for (i = 0; i < nparts; i++)
+        fn (&parts[i]);
+#endif
+}
+
+/* Read 'len' bytes at 'offset' of 'fd', failing with WTMP_ETRUNCATED if
+ * the file ends before them */
+static int
+refreshread (int fd, char *buf, size_t len, off_t offset)
+{
+    ssize_t nread;
+
+    while (len > 0)
+      {
+          nread = pread (fd, buf, len, offset);
+          STATS_ADD (readcalls, 1);
+          if (nread < 0)
+            {
+                if (errno == EINTR)
                     continue;
+                return WTMP_ESYS;
+            }
+          if (nread == 0)
+              return WTMP_ETRUNCATED;
+          STATS_ADD (bytesread, nread);
+          buf += nread;
+          offset += nread;
+          len -= nread;
+      }
+
+    return 0;
+}
+
+/* Patch again the records of the 'nparts' partitions 'parts' that have
+ * been changed since they were scanned, now that their range of 'fd',
+ * ending at 'end', is locked: a record no longer selected is left alone.
+ * Set 'npatches' to the number of patched records left.  */
+static int
+editrefresh (int fd, struct editpart *parts, int nparts, off_t end,
+             size_t *npatches)
+{
+    struct wtmppatch *pp;
+    const STRUCT_UTMP *cur;
+    char *buf;
+    off_t from = 0, to = 0;
+    size_t i, n, len;
+    int part, rc = 0;
+
+    /* The range is read again in blocks, each one starting at the first
+       patched record it holds: the lock does not keep the file from being
+       truncated, so it is not mapped */
+    if ((buf = malloc (REFRESH_NREC * sizeof (STRUCT_UTMP))) == NULL)
+        return WTMP_ESYS;
+    STATS_ADD (allocs, 1);
 
-                if (fake)
-                    strncpy (UT_USER (utp), fake, sizeof (UT_USER (utp)));
-                else
+    *npatches = 0;
+    for (part = 0; part < nparts; part++)
+      {
+          for (i = n = 0; i < parts[part].npatches; i++)
+            {
+                pp = &parts[part].patches[i];
+                if (pp->offset >= to)
                   {
-                      /* Simulates the job of init when a process has exited:
-                       * leave ut_pid untouched, sets ut_type to DEAD_PROCESS
-                       * and fills ut_user, ut_host with null bytes
-                       * ex:
-                       * root [11735] [pts/0] [ts/0] [10.0.0.1] [10.0.0.1] [Mon Jan 12 17:31:24 2009 CET]
-                       * DEAD [11735] [pts/0] [    ] [        ] [0.0.0.0 ] [Mon Jan 12 17:31:24 2009 CET]
-                       */
-                      utp->ut_type = DEAD_PROCESS;
-                      memset (UT_USER (utp), 0, sizeof (UT_USER (utp)));
-                      memset (utp->ut_id, 0, sizeof utp->ut_id);
-                      memset (utp->ut_host, 0, sizeof utp->ut_host);
-                      memset (utp->ut_addr_v6, 0, sizeof utp->ut_addr_v6);
-                      /*UT_TIME_MEMBER (utp) = utp->ut_tv.tv_usec = 0; */
+                      from = pp->offset;
+                      len = REFRESH_NREC * sizeof (STRUCT_UTMP);
+                      if ((off_t) len > end - from)
+                          len = end - from;
+                      if ((rc = refreshread (fd, buf, len, from)) < 0)
+                          goto out;
+                      to = from + len;
                   }
+                cur = (const STRUCT_UTMP *) (buf + (pp->offset - from));
+                if (memcmp (cur, &pp->orig, sizeof (STRUCT_UTMP)))
+                  {
+                      memcpy (&pp->orig, cur, sizeof (STRUCT_UTMP));
+                      if (!parts[part].patch (&pp->orig, &pp->rec,
+                                              parts[part].arg))
+                          continue;
+                  }
+                if (n < i)
+                    memcpy (&parts[part].patches[n], pp, sizeof (*pp));
+                n++;
+            }
+          parts[part].npatches = n;
+          *npatches += n;
+      }
+
+  out:
+    free (buf);
+    return rc;
+}
+
+/* Append the 'npatches' patched records of the 'nparts' partitions 'parts'
+ * to the undo journal 'journal' */
+static int
+editjournal (const char *journal, const struct stat *sb,
+             const struct editpart *parts, int nparts, size_t npatches)
+{
+    struct wtmppatch *patches;
+    size_t n = 0;
+    int i, rc, saved_errno;
+
+    if (nparts == 1)
+        return wtmpjournal_append (journal, sb, parts[0].patches, npatches);
 
-                if (PUT_UTMP_LINE (utp))
-                    cleanrec++;
-                else
-                    cleanerr++;
+    if ((patches = malloc (npatches * sizeof (struct wtmppatch))) == NULL)
+        return WTMP_ESYS;
+    STATS_ADD (allocs, 1);
+    for (i = 0; i < nparts; i++)
+      {
+          memcpy (patches + n, parts[i].patches,
+                  parts[i].npatches * sizeof (struct wtmppatch));
+          n += parts[i].npatches;
+      }
+
+    rc = wtmpjournal_append (journal, sb, patches, npatches);
+    saved_errno = errno;
+    free (patches);
+    errno = saved_errno;
+
+    return rc;
+}
+
+/* Patch in place the records of 'wtmpfile' selected by 'patch', which is
+ * called for each record 'utp' and returns 1 after writing the new content
+ * of the record in 'rec', 0 to leave the record alone.  If 'flags' has
+ * WTMPEDIT_PARALLEL, 'patch' can be called by several threads at once and
+ * a large file is scanned in parallel partitions.  The records in the file
+ * when the scan starts are patched under a write lock on their range, only
+ * held while they are written back, and the ownership and times of the
+ * file are preserved.  If 'journal' is not NULL, the original records are
+ * appended to this undo journal before the file is changed (see
+ * wtmprevert).  Set 'cleanrec' to the number of records changed and return
+ * 0 or a WTMP_E* error code.  */
+int
+wtmpedit_apply (const char *wtmpfile,
+                int (*patch) (const STRUCT_UTMP *utp, STRUCT_UTMP *rec,
+                              void *arg), void *arg, int flags,
+                const char *journal, unsigned int *cleanrec)
+{
+    struct editpart parts[EDIT_MAXPARTS];
+    struct stat sb;
+    struct utimbuf currtime;
+    struct flock lock;
+    size_t npatches = 0;
+    off_t nrec, start, end;
+    int fd = -1, nparts, i, rc, saved_errno, prevphase;
+
+    *cleanrec = 0;
+    prevphase = STATS_PHASE (WTMPSTATS_OPEN);
+
+    rc = WTMP_ESYS;
+    if (lstat (wtmpfile, &sb) == -1)
+        goto out;
+    if (!S_ISREG (sb.st_mode))
+      {
+          rc = WTMP_ENOTREG;
+          goto out;
+      }
+
+    if ((fd = open (wtmpfile, O_RDWR)) < 0)
+        goto out;
+    if (fstat (fd, &sb) < 0)
+        goto out_fd;
+
+    /* The file is read, not mapped, since it can be truncated under the
+       scan; only a sequential scan keeps several reads in flight */
+    nparts = (flags & WTMPEDIT_PARALLEL) ? editnparts (sb.st_size) : 1;
+    memset (parts, 0, sizeof parts);
+    if ((rc = wtmpreader_open (&parts[0].rd, wtmpfile,
+                               nparts > 1 ? 0 : WTMPREADER_ASYNC)) < 0)
+        goto out_fd;
+    /* The records are written back as they are read */
+    if (parts[0].rd.layout->decode)
+      {
+          rc = WTMP_ELAYOUT;
+          wtmpreader_close (&parts[0].rd);
+          goto out_fd;
+      }
+
+    /* The partitions after the first one have their own reader, placed at
+       the start of the partition.  The last one goes on up to the end of
+       its snapshot.  */
+    nrec = sb.st_size / sizeof (STRUCT_UTMP);
+    for (i = 1; i < nparts; i++)
+      {
+          if ((rc = wtmpreader_open (&parts[i].rd, wtmpfile, 0)) < 0)
+            {
+                nparts = i;
+                goto out_parts;
+            }
+          rc = (parts[i].rd.layout != parts[0].rd.layout) ? WTMP_ELAYOUT :
+              wtmpreader_seek (&parts[i].rd,
+                               nrec * i / nparts * sizeof (STRUCT_UTMP));
+          if (rc < 0)
+            {
+                nparts = i + 1;
+                goto out_parts;
             }
       }
-    if (errno)
-        die (errno, "error while accessing the wtmp file");
+    for (i = 0; i < nparts; i++)
+      {
+          parts[i].nrec = (i < nparts - 1) ?
+              (size_t) (nrec * (i + 1) / nparts - nrec * i / nparts) :
+              (size_t) -1;
+          parts[i].patch = patch;
+          parts[i].arg = arg;
+          parts[i].fd = fd;
+      }
+
+    /* First collect the patched records, to journal them before the
+       file is changed */
+    STATS_PHASE (WTMPSTATS_PAIR);
+    editrun (editscan, parts, nparts);
+    rc = 0;
+    for (i = 0; i < nparts && rc == 0; i++)
+      {
+          if ((rc = parts[i].rc) < 0)
+              errno = parts[i].err;
+          npatches += parts[i].npatches;
+      }
+    if (rc < 0 || npatches == 0)
+        goto out_parts;
+
+    STATS_PHASE (WTMPSTATS_WRITEBACK);
+    for (i = 0; parts[i].npatches == 0; i++)
+        ;
+    start = parts[i].patches[0].offset;
+    for (i = nparts - 1; parts[i].npatches == 0; i--)
+        ;
+    end = parts[i].patches[parts[i].npatches - 1].offset +
+        sizeof (STRUCT_UTMP);
+
+    memset (&lock, 0, sizeof lock);
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = start;
+    lock.l_len = end - start;
+    rc = WTMP_ESYS;
+    if (fcntl (fd, F_SETLKW, &lock) < 0 || fstat (fd, &sb) < 0)
+        goto out_parts;
+    /* The file has been rotated by truncation in the meantime */
+    if (sb.st_size < end)
+      {
+          rc = WTMP_ETRUNCATED;
+          goto out_parts;
+      }
+    currtime.actime = sb.st_atime;
+    currtime.modtime = sb.st_mtime;
+    if ((rc = editrefresh (fd, parts, nparts, end, &npatches)) < 0 ||
+        npatches == 0)
+        goto out_parts;
+
+    if (journal &&
+        (rc = editjournal (journal, &sb, parts, nparts, npatches)) < 0)
+        goto out_parts;
+
+    editrun (editwrite, parts, nparts);
+    for (i = 0; i < nparts; i++)
+      {
+          *cleanrec += parts[i].written;
+          if (parts[i].rc < 0 && rc == 0)
+            {
+                rc = parts[i].rc;
+                errno = parts[i].err;
+            }
+      }
+    if (rc == 0 && fsync (fd) < 0)
+        rc = WTMP_ESYS;
+
+    /* The sidecar index no longer describes the patched records, and
+       the readers caching them must know about the change */
+    if (*cleanrec > 0)
+      {
+          /* Failing to update the sidecar files, or to restore the times
+             and the ownership, is not fatal */
+          saved_errno = errno;
+          wtmpindex_remove (wtmpfile);
+          wtmpgeneration_bump (wtmpfile);
+          if (fchown (fd, sb.st_uid, sb.st_gid) == 0)
+              utime (wtmpfile, &currtime);
+          errno = saved_errno;
+      }
+
+  out_parts:
+    saved_errno = errno;
+    for (i = 0; i < nparts; i++)
+      {
+          wtmpreader_close (&parts[i].rd);
+          free (parts[i].patches);
+      }
+    errno = saved_errno;
+  out_fd:
+    saved_errno = errno;
+    close (fd);                 /* also releases the lock */
+    errno = saved_errno;
+  out:
+    STATS_PHASE (prevphase);
+
+    return rc;
+}
+
+struct editarg
+{
+    const char *user, *fake;
+    struct wtmptime *time;
+};
+
+static int
+editpatch (const STRUCT_UTMP *utp, STRUCT_UTMP *rec, void *arg)
+{
+    struct editarg *e = arg;
+
+    if (utp->ut_type != USER_PROCESS ||
+        strncmp (UT_USER (utp), e->user, sizeof (UT_USER (utp))))
+        return 0;
+    if (!wtmptime_match (e->time, UT_TIME_MEMBER (utp)))
+        return 0;
+
+    memcpy (rec, utp, sizeof (STRUCT_UTMP));
+    if (e->fake)
+        strncpy (UT_USER (rec), e->fake, sizeof (UT_USER (rec)));
+    else
+      {
+          /* Simulates the job of init when a process has exited:
+           * leave ut_pid untouched, sets ut_type to DEAD_PROCESS
+           * and fills ut_user, ut_host with null bytes
+           * ex:
+           * root [11735] [pts/0] [ts/0] [10.0.0.1] [10.0.0.1] [Mon Jan 12 17:31:24 2009 CET]
+           * DEAD [11735] [pts/0] [    ] [        ] [0.0.0.0 ] [Mon Jan 12 17:31:24 2009 CET]
+           */
+          rec->ut_type = DEAD_PROCESS;
+          memset (UT_USER (rec), 0, sizeof (UT_USER (rec)));
+          memset (rec->ut_id, 0, sizeof rec->ut_id);
+          memset (rec->ut_host, 0, sizeof rec->ut_host);
+#ifdef HAVE_UTP_UT_ADDR_V6
+          memset (rec->ut_addr_v6, 0, sizeof rec->ut_addr_v6);
+#endif
+      }
+
+    return 1;
+}
+
+/* Hide the login records of 'user' whose time matches 'timepattern': the
+ * user name is replaced by 'fake', or the records are turned into logout
+ * records if 'fake' is NULL (see wtmpedit_apply).  */
+int
+wtmpedit (const char *wtmpfile, const char *user, const char *fake,
+          const char *timepattern, const char *journal,
+          unsigned int *cleanrec)
+{
+    struct editarg e;
+    int rc;
 
-    END_UTMP_ENT ();
-    regfree (&regex);
+    *cleanrec = 0;
+    if ((rc = wtmptime_compile (timepattern, &e.time)) < 0)
+        return rc;
+    e.user = user;
+    e.fake = fake;
 
-    if (chown (wtmpfile, owner, group) < 0)
-        fprintf (stderr, "cannot preserve the ownership of the wtmp file\n");
-    if (utime (wtmpfile, &currtime) < 0)
-        fprintf (stderr, "cannot preserve access and modification times\n");
+    rc = wtmpedit_apply (wtmpfile, editpatch, &e, WTMPEDIT_PARALLEL, journal,
+                         cleanrec);
+    wtmptime_free (e.time);
 
-    return cleanrec;
+    return rc;
 }
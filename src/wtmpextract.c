@@ -0,0 +1,177 @@
+/*
+ * wtmpextract.c -- Copy the selected records of a wtmp file.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The selected records are gathered in a write buffer, but a run of
+ * selected records that are contiguous in a native file is taken out of
+ * the buffer once it reaches EXTRACT_MINRUN bytes: the whole run is then
+ * given to the kernel in a single copy (see wtmpcopyrange) when it is
+ * broken.  Extracting a slice of the file thus costs a scan and one copy,
+ * while the scattered records of a user are written in large blocks.  The
+ * records decoded from a foreign layout are written in the native layout.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "wtmpclean.h"
+
+/* Size of the write buffer, in records */
+#define EXTRACT_NREC    1024
+
+/* Length of a run of contiguous records copied in the kernel, at least */
+#define EXTRACT_MINRUN  (64 * 1024)
+
+/* Write to 'out', at its current position, the records of 'wtmpfile' of
+ * 'user' (all if NULL) whose time matches 'timepattern' (all if NULL), as
+ * a wtmp file in the native layout.  'out' can be a pipe.  The number of
+ * records written is returned in 'nrec'.  Return 0 or a WTMP_E* error
+ * code.  */
+int
+wtmpextract (const char *wtmpfile, const char *user, const char *timepattern,
+             int out, unsigned long *nrec)
+{
+    struct wtmpreader rd;
+    struct wtmptime *tp = NULL;
+    STRUCT_UTMP *utp;
+    char *buf = NULL;
+    size_t len = 0;
+    off_t runstart = 0, runlen = 0, offset;
+    int native, inkernel = 0, method = -1, rc, saved_errno, prevphase;
+
+    *nrec = 0;
+    prevphase = STATS_PHASE (WTMPSTATS_OPEN);
+    if (timepattern && (rc = wtmptime_compile (timepattern, &tp)) < 0)
+      {
+          STATS_PHASE (prevphase);
+          return rc;
+      }
+    /* The pages scanned are copied next: they are kept in the cache */
+    if ((rc = wtmpreader_open (&rd, wtmpfile, WTMPREADER_ASYNC |
+                               WTMPREADER_MMAP |
+                               (wtmpreader_tail ? WTMPREADER_TAIL : 0))) < 0)
+      {
+          wtmptime_free (tp);
+          STATS_PHASE (prevphase);
+          return rc;
+      }
+    native = (rd.layout == wtmplayout_native ());
+
+    rc = WTMP_ESYS;
+    if ((buf = malloc (EXTRACT_NREC * sizeof (STRUCT_UTMP))) == NULL)
+        goto out;
+
+    STATS_PHASE (WTMPSTATS_SCAN);
+    while ((utp = wtmpreader_next (&rd)) != NULL)
+      {
+          if (user && strncmp (UT_USER (utp), user, sizeof (UT_USER (utp))))
+              continue;
+          if (tp && !wtmptime_match (tp, UT_TIME_MEMBER (utp)))
+              continue;
+          STATS_ADD (matched, 1);
+          STATS_ADD (written, 1);
+          (*nrec)++;
+
+          offset = native ? wtmpreader_tell (&rd) : -1;
+          if (inkernel)
+            {
+                if (offset == runstart + runlen)
+                  {
+                      runlen += sizeof (STRUCT_UTMP);
+                      continue;
+                  }
+                if (wtmpcopyrange (rd.fd, runstart, out, runlen, &method) < 0)
+                    goto out;
+                inkernel = 0;
+                runlen = 0;
+            }
+          if (!native || offset != runstart + runlen)
+            {
+                runstart = offset;
+                runlen = 0;
+            }
+
+          /* The run, at the end of the buffer, is copied in the kernel */
+          if (native && runlen + sizeof (STRUCT_UTMP) >= EXTRACT_MINRUN)
+            {
+                len -= runlen;
+                if (len > 0 && wtmpwrite (out, buf, len) < 0)
+                    goto out;
+                len = 0;
+                runlen += sizeof (STRUCT_UTMP);
+                inkernel = 1;
+                continue;
+            }
+
+          if (len == EXTRACT_NREC * sizeof (STRUCT_UTMP))
+            {
+                if (wtmpwrite (out, buf, len) < 0)
+                    goto out;
+                len = 0;
+                runstart = offset;
+                runlen = 0;
+            }
+          memcpy (buf + len, utp, sizeof (STRUCT_UTMP));
+          len += sizeof (STRUCT_UTMP);
+          runlen += sizeof (STRUCT_UTMP);
+      }
+    if ((rc = wtmpreader_error (&rd)) < 0)
+        goto out;
+
+    STATS_PHASE (WTMPSTATS_WRITEBACK);
+    rc = WTMP_ESYS;
+    if (len > 0 && wtmpwrite (out, buf, len) < 0)
+        goto out;
+    if (inkernel &&
+        wtmpcopyrange (rd.fd, runstart, out, runlen, &method) < 0)
+        goto out;
+    rc = 0;
+
+  out:
+    saved_errno = errno;
+    free (buf);
+    wtmpreader_close (&rd);
+    wtmptime_free (tp);
+    STATS_PHASE (prevphase);
+    errno = saved_errno;
+
+    return rc;
+}
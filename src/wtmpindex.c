@@ -0,0 +1,831 @@
+/*
+ * wtmpindex.c -- Persistent sidecar index of the wtmp records.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The index is stored in the file <wtmpfile>.idx and has the layout:
+ *
+ *   struct idxheader       fingerprint of the indexed wtmp file
+ *   struct idxkey          one per user and per terminal line, plus one key
+ *                          for the system records (boot, runlevel, time)
+ *   uint32_t               the posting lists of record numbers, sorted
+ *
+ * The index is only used when the fingerprint (device, inode, size, mtime
+ * and ctime) still matches the wtmp file; a full scan is done otherwise.
+ * The size is the one of the whole file, partial trailing record included,
+ * unless records have been appended during the build: the size of the
+ * indexed records is then recorded, and the index looks out of date.
+ * Note that the ctime is also changed by an in-place edit that restores the
+ * original mtime.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "wtmpclean.h"
+
+#define IDX_MAGIC       "WTMPIDX"
+#define IDX_VERSION     4
+#define IDX_SUFFIX      ".idx"
+#define GEN_SUFFIX      ".gen"
+#define IDX_NAMESIZE    32      /* size of the user and line keys */
+#define IDX_HASHSIZE    1021    /* buckets of the in-memory key table */
+#define IDX_BATCH       256     /* max records fetched by a single pread */
+#define IDX_MAXGAP      16      /* unwanted records read to merge two runs */
+
+/* Kinds of keys */
+#define IDX_USER        1       /* all the records with a given ut_user */
+#define IDX_LINE        2       /* login and logout records of a tty line */
+#define IDX_SYSTEM      3       /* boot, runlevel and time change records */
+
+struct idxheader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t recsize;           /* size of a record in the wtmp file */
+    char layout[16];            /* name of the record layout */
+    uint64_t dev, ino, size;
+    uint64_t datasize;          /* size of the indexed records */
+    int64_t mtime, mtime_nsec;
+    int64_t ctime, ctime_nsec;
+    uint64_t lasthash;          /* hash of the last indexed record */
+    uint32_t nrecords;
+    uint32_t nkeys;
+    uint32_t npostings;
+};
+
+struct idxkey
+{
+    char name[IDX_NAMESIZE];
+    uint32_t kind;
+    uint32_t count;             /* number of postings */
+    uint32_t first;             /* position of the first posting */
+    uint32_t unused;
+};
+
+/* The content of an index file loaded in memory */
+struct idxfile
+{
+    struct idxheader *hdr;
+    struct idxkey *keys;
+    uint32_t *postings;
+};
+
+/* A key of the in-memory table used while building the index */
+struct idxentry
+{
+    char name[IDX_NAMESIZE];
+    uint32_t kind;
+    uint32_t count, alloc;
+    uint32_t *recs;
+    struct idxentry *next;
+};
+
+/* Query cursor returned by wtmpindex_open() */
+struct wtmpindex
+{
+    int fd;
+    const struct wtmplayout *layout;
+    uint32_t *recs;             /* sorted record numbers to be returned */
+    size_t nrecs, next;
+    char *buf;                  /* records read by the last pread */
+    STRUCT_UTMP *dec;           /* the same records, if decoded */
+    uint32_t bufstart, buflen;
+    int error;                  /* errno of a failed read */
+};
+
+/* Return the path of the sidecar file <wtmpfile><suffix> */
+static char *
+idxpath (const char *wtmpfile, const char *suffix)
+{
+    char *path;
+
+    if ((path = malloc (strlen (wtmpfile) + strlen (suffix) + 1)) != NULL)
+        sprintf (path, "%s%s", wtmpfile, suffix);
+
+    return path;
+}
+
+static void
+fingerprint (struct idxheader *hdr, const struct stat *sb)
+{
+    hdr->dev = sb->st_dev;
+    hdr->ino = sb->st_ino;
+    hdr->size = sb->st_size;
+    hdr->mtime = sb->st_mtim.tv_sec;
+    hdr->mtime_nsec = sb->st_mtim.tv_nsec;
+    hdr->ctime = sb->st_ctim.tv_sec;
+    hdr->ctime_nsec = sb->st_ctim.tv_nsec;
+}
+
+static int
+fingerprintmatch (const struct idxheader *hdr, const struct stat *sb)
+{
+    return (hdr->dev == (uint64_t) sb->st_dev &&
+            hdr->ino == (uint64_t) sb->st_ino &&
+            hdr->size == (uint64_t) sb->st_size &&
+            hdr->mtime == sb->st_mtim.tv_sec &&
+            hdr->mtime_nsec == sb->st_mtim.tv_nsec &&
+            hdr->ctime == sb->st_ctim.tv_sec &&
+            hdr->ctime_nsec == sb->st_ctim.tv_nsec);
+}
+
+/* Load an index file in memory.  Return 0 if the file does not exist or is
+ * not a valid index.  */
+static int
+idxload (const char *path, struct idxfile *idx)
+{
+    struct idxheader *hdr;
+    const struct idxkey *k;
+    const uint32_t *p;
+    struct stat sb;
+    uint64_t expected;
+    uint32_t i;
+    char *data;
+    ssize_t nread;
+    int fd;
+
+    if ((fd = open (path, O_RDONLY)) < 0)
+        return 0;
+    if (fstat (fd, &sb) < 0 || (size_t) sb.st_size < sizeof (*hdr))
+      {
+          close (fd);
+          return 0;
+      }
+    if ((data = malloc (sb.st_size)) == NULL)
+      {
+          close (fd);
+          return 0;
+      }
+    nread = read (fd, data, sb.st_size);
+    close (fd);
+
+    hdr = (struct idxheader *) data;
+    if (nread != sb.st_size ||
+        memcmp (hdr->magic, IDX_MAGIC, sizeof (IDX_MAGIC)) ||
+        hdr->version != IDX_VERSION)
+      {
+          free (data);
+          return 0;
+      }
+
+    expected = sizeof (*hdr) +
+        (uint64_t) hdr->nkeys * sizeof (struct idxkey) +
+        (uint64_t) hdr->npostings * sizeof (uint32_t);
+    if (expected != (uint64_t) sb.st_size ||
+        hdr->datasize != (uint64_t) hdr->nrecords * hdr->recsize ||
+        hdr->datasize > hdr->size)
+      {
+          free (data);
+          return 0;
+      }
+
+    idx->hdr = hdr;
+    idx->keys = (struct idxkey *) (hdr + 1);
+    idx->postings = (uint32_t *) (idx->keys + hdr->nkeys);
+
+    /* The posting lists are read without any further check */
+    for (i = 0, k = idx->keys; i < hdr->nkeys; i++, k++)
+        if ((uint64_t) k->first + k->count > hdr->npostings)
+          {
+              free (data);
+              return 0;
+          }
+    for (i = 0, p = idx->postings; i < hdr->npostings; i++, p++)
+        if (*p >= hdr->nrecords)
+          {
+              free (data);
+              return 0;
+          }
+
+    return 1;
+}
+
+static unsigned int
+keyhash (const char *name, uint32_t kind)
+{
+    unsigned int h = kind;
+    size_t i;
+
+    for (i = 0; i < IDX_NAMESIZE && name[i]; i++)
+        h = h * 31 + (unsigned char) name[i];
+
+    return h % IDX_HASHSIZE;
+}
+
+static struct idxentry *
+keylookup (struct idxentry **table, const char *name, size_t namelen,
+           uint32_t kind)
+{
+    struct idxentry *e;
+    char key[IDX_NAMESIZE];
+    unsigned int h;
+
+    memset (key, 0, sizeof key);
+    strncpy (key, name,
+             (namelen < sizeof key) ? namelen : sizeof key);
+
+    h = keyhash (key, kind);
+    for (e = table[h]; e; e = e->next)
+        if (e->kind == kind && memcmp (e->name, key, sizeof key) == 0)
+            return e;
+
+    if ((e = calloc (1, sizeof (struct idxentry))) == NULL)
+        return NULL;
+    memcpy (e->name, key, sizeof key);
+    e->kind = kind;
+    e->next = table[h];
+    table[h] = e;
+
+    return e;
+}
+
+static int
+keyappend (struct idxentry *e, uint32_t recno)
+{
+    uint32_t *recs;
+
+    if (!e)
+        return WTMP_ESYS;
+    if (e->count == e->alloc)
+      {
+          recs = realloc (e->recs,
+                          (e->alloc ? 2 * e->alloc : 16) * sizeof (uint32_t));
+          if (recs == NULL)
+              return WTMP_ESYS;
+          e->recs = recs;
+          e->alloc = e->alloc ? 2 * e->alloc : 16;
+      }
+    e->recs[e->count++] = recno;
+
+    return 0;
+}
+
+static int
+idxadd (struct idxentry **table, const STRUCT_UTMP *utp, uint32_t recno)
+{
+    if (keyappend (keylookup (table, UT_USER (utp), sizeof (UT_USER (utp)),
+                              IDX_USER), recno) < 0)
+        return WTMP_ESYS;
+
+    switch (utp->ut_type)
+      {
+      default:
+          return 0;
+      case USER_PROCESS:
+      case DEAD_PROCESS:
+          return keyappend (keylookup (table, utp->ut_line,
+                                       sizeof utp->ut_line, IDX_LINE), recno);
+#ifdef RUN_LVL
+      case RUN_LVL:
+#endif
+      case BOOT_TIME:
+      case OLD_TIME:
+      case NEW_TIME:
+          return keyappend (keylookup (table, "", 0, IDX_SYSTEM), recno);
+      }
+}
+
+/* Check the hash of the record 'recno', in the layout of the reader */
+static int
+lasthashmatch (struct wtmpreader *rd, uint32_t recno, uint64_t hash)
+{
+    const size_t recsize = rd->layout->recsize;
+    STRUCT_UTMP last;
+    char *raw;
+    int match = 0;
+
+    if ((raw = malloc (recsize)) == NULL)
+        return 0;
+    if (pread (rd->fd, raw, recsize, (off_t) recno * recsize)
+        == (ssize_t) recsize)
+      {
+          if (rd->layout->decode)
+              rd->layout->decode (raw, 1, &last);
+          else
+              memcpy (&last, raw, sizeof last);
+          match = (wtmphash (&last, sizeof last) == hash);
+      }
+    free (raw);
+
+    return match;
+}
+
+static void
+tablefree (struct idxentry **table)
+{
+    struct idxentry *e, *enext;
+    int i;
+
+    for (i = 0; i < IDX_HASHSIZE; i++)
+        for (e = table[i]; e; e = enext)
+          {
+              enext = e->next;
+              free (e->recs);
+              free (e);
+          }
+}
+
+/* Build or update the index of 'wtmpfile'.  When the file has only grown
+ * since the last build, just the appended records are scanned.
+ * Set 'nrec' to the total number of indexed records and 'newrec' to the
+ * number of records scanned.  */
+int
+wtmpindex_build (const char *wtmpfile, unsigned long *nrec,
+                 unsigned long *newrec)
+{
+    struct idxentry *table[IDX_HASHSIZE], *e;
+    struct idxheader hdr;
+    struct idxfile old;
+    struct wtmpreader rd;
+    struct stat sb;
+    STRUCT_UTMP *utp;
+    uint32_t recno = 0, npostings = 0, i;
+    char *path = NULL, *tmppath = NULL;
+    int fd = -1, rc, saved_errno;
+
+    memset (table, 0, sizeof table);
+    memset (&hdr, 0, sizeof hdr);
+
+    if ((rc = wtmpreader_open (&rd, wtmpfile,
+                               WTMPREADER_ASYNC | WTMPREADER_DONTNEED)) < 0)
+        return rc;
+    rc = WTMP_ESYS;
+    if (fstat (rd.fd, &sb) < 0)
+        goto out;
+    if (!S_ISREG (sb.st_mode))
+      {
+          rc = WTMP_ENOTREG;
+          goto out;
+      }
+    /* The records appended since the snapshot read are not indexed: the
+       index is made to look out of date, and is completed next time */
+    if (sb.st_size > rd.size)
+        sb.st_size = rd.size;
+
+    if ((path = idxpath (wtmpfile, IDX_SUFFIX)) == NULL)
+        goto out;
+
+    /* Reuse the old index if the wtmp file has only been appended to */
+    if (idxload (path, &old))
+      {
+          if (old.hdr->dev == (uint64_t) sb.st_dev &&
+              old.hdr->ino == (uint64_t) sb.st_ino &&
+              old.hdr->datasize <= (uint64_t) sb.st_size &&
+              old.hdr->recsize == rd.layout->recsize &&
+              !strncmp (old.hdr->layout, rd.layout->name,
+                        sizeof old.hdr->layout) &&
+              (old.hdr->nrecords == 0 ||
+               lasthashmatch (&rd, old.hdr->nrecords - 1,
+                              old.hdr->lasthash)))
+            {
+                recno = old.hdr->nrecords;
+                hdr.lasthash = old.hdr->lasthash;
+
+                for (i = 0; i < old.hdr->nkeys; i++)
+                  {
+                      struct idxkey *k = &old.keys[i];
+                      uint32_t j;
+
+                      e = keylookup (table, k->name, sizeof k->name, k->kind);
+                      for (j = 0; j < k->count; j++)
+                          if (keyappend (e, old.postings[k->first + j]) < 0)
+                            {
+                                free (old.hdr);
+                                goto out;
+                            }
+                  }
+                if (wtmpreader_seek (&rd, (off_t) recno * rd.layout->recsize)
+                    < 0)
+                  {
+                      free (old.hdr);
+                      goto out;
+                  }
+            }
+          free (old.hdr);
+      }
+
+    *newrec = 0;
+    while ((utp = wtmpreader_next (&rd)) != NULL)
+      {
+          if (idxadd (table, utp, recno) < 0)
+              goto out;
+          hdr.lasthash = wtmphash (utp, sizeof (STRUCT_UTMP));
+          recno++;
+          (*newrec)++;
+      }
+    if (wtmpreader_error (&rd) < 0)
+        goto out;
+
+    /* The fingerprint must describe the file content actually indexed:
+       the records appended during the scan are not, while a partial
+       record at the end of the file cannot be */
+    if (fstat (rd.fd, &sb) < 0)
+        goto out;
+
+    memcpy (hdr.magic, IDX_MAGIC, sizeof (IDX_MAGIC));
+    hdr.version = IDX_VERSION;
+    hdr.recsize = rd.layout->recsize;
+    strncpy (hdr.layout, rd.layout->name, sizeof hdr.layout - 1);
+    fingerprint (&hdr, &sb);
+    hdr.datasize = (uint64_t) recno * rd.layout->recsize;
+    if (hdr.size - hdr.size % rd.layout->recsize != hdr.datasize)
+        hdr.size = hdr.datasize;
+    hdr.nrecords = recno;
+    for (i = 0; i < IDX_HASHSIZE; i++)
+        for (e = table[i]; e; e = e->next)
+          {
+              hdr.nkeys++;
+              npostings += e->count;
+          }
+    hdr.npostings = npostings;
+
+    if ((tmppath = malloc (strlen (path) + sizeof (".tmp"))) == NULL)
+        goto out;
+    sprintf (tmppath, "%s.tmp", path);
+
+    if ((fd = open (tmppath, O_WRONLY | O_CREAT | O_TRUNC,
+                    sb.st_mode & 0666)) < 0)
+        goto out;
+
+    if (wtmpwrite (fd, &hdr, sizeof hdr) < 0)
+        goto out;
+
+    npostings = 0;
+    for (i = 0; i < IDX_HASHSIZE; i++)
+        for (e = table[i]; e; e = e->next)
+          {
+              struct idxkey k;
+
+              memset (&k, 0, sizeof k);
+              memcpy (k.name, e->name, sizeof k.name);
+              k.kind = e->kind;
+              k.count = e->count;
+              k.first = npostings;
+              npostings += e->count;
+              if (wtmpwrite (fd, &k, sizeof k) < 0)
+                  goto out;
+          }
+    for (i = 0; i < IDX_HASHSIZE; i++)
+        for (e = table[i]; e; e = e->next)
+            if (wtmpwrite (fd, e->recs, e->count * sizeof (uint32_t)) < 0)
+                goto out;
+
+    rc = close (fd);
+    fd = -1;
+    if (rc < 0 || rename (tmppath, path) < 0)
+      {
+          rc = WTMP_ESYS;
+          goto out;
+      }
+
+    *nrec = recno;
+    rc = 0;
+
+  out:
+    saved_errno = errno;
+    if (fd >= 0)
+      {
+          close (fd);
+          unlink (tmppath);
+      }
+    wtmpreader_close (&rd);
+    tablefree (table);
+    free (tmppath);
+    free (path);
+    errno = saved_errno;
+
+    return rc;
+}
+
+/* Remove the index of 'wtmpfile', if any (the records have been changed) */
+int
+wtmpindex_remove (const char *wtmpfile)
+{
+    char *path;
+    int rc = 0;
+
+    if ((path = idxpath (wtmpfile, IDX_SUFFIX)) == NULL)
+        return WTMP_ESYS;
+    if (unlink (path) < 0 && errno != ENOENT)
+        rc = WTMP_ESYS;
+    free (path);
+
+    return rc;
+}
+
+/* Record that the records of 'wtmpfile' have been changed in place: the
+ * generation of the file is the size of <wtmpfile>.gen, which grows by one
+ * byte at each edit, with no need to lock it.  */
+int
+wtmpgeneration_bump (const char *wtmpfile)
+{
+    char *path;
+    int fd, rc = 0;
+
+    if ((path = idxpath (wtmpfile, GEN_SUFFIX)) == NULL)
+        return WTMP_ESYS;
+    if ((fd = open (path, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0 ||
+        write (fd, "", 1) != 1)
+        rc = WTMP_ESYS;
+    if (fd >= 0)
+        close (fd);
+    free (path);
+
+    return rc;
+}
+
+/* Return the generation of 'wtmpfile' (see wtmpgeneration_bump), 0 if it
+ * has never been edited in place, or -1 if it cannot be read.  */
+int64_t
+wtmpgeneration (const char *wtmpfile)
+{
+    struct stat sb;
+    char *path;
+    int64_t gen;
+
+    if ((path = idxpath (wtmpfile, GEN_SUFFIX)) == NULL)
+        return -1;
+    if (stat (path, &sb) == 0)
+        gen = sb.st_size;
+    else
+        gen = (errno == ENOENT) ? 0 : -1;
+    free (path);
+
+    return gen;
+}
+
+static const struct idxkey *
+idxfind (const struct idxfile *idx, const char *name, size_t namelen,
+         uint32_t kind)
+{
+    char key[IDX_NAMESIZE];
+    uint32_t i;
+
+    memset (key, 0, sizeof key);
+    strncpy (key, name, (namelen < sizeof key) ? namelen : sizeof key);
+
+    for (i = 0; i < idx->hdr->nkeys; i++)
+        if (idx->keys[i].kind == kind &&
+            memcmp (idx->keys[i].name, key, sizeof key) == 0)
+            return &idx->keys[i];
+
+    return NULL;
+}
+
+/* Merge the posting list of 'k' into the sorted array 'recs' */
+static int
+postingsmerge (struct wtmpindex *q, const struct idxfile *idx,
+               const struct idxkey *k)
+{
+    const uint32_t *p;
+    uint32_t *merged;
+    size_t i = 0, j = 0, n = 0;
+
+    if (!k || k->count == 0)
+        return 0;
+
+    p = idx->postings + k->first;
+    if ((merged = malloc ((q->nrecs + k->count) * sizeof (uint32_t))) == NULL)
+        return WTMP_ESYS;
+
+    while (i < q->nrecs || j < k->count)
+      {
+          if (j == k->count || (i < q->nrecs && q->recs[i] < p[j]))
+              merged[n++] = q->recs[i++];
+          else if (i == q->nrecs || p[j] < q->recs[i])
+              merged[n++] = p[j++];
+          else
+            {
+                merged[n++] = q->recs[i++];
+                j++;
+            }
+      }
+
+    free (q->recs);
+    q->recs = merged;
+    q->nrecs = n;
+
+    return 0;
+}
+
+/* Open a query on the index of 'wtmpfile'.
+ * Return NULL if there is no index or if it is out of date: in this case the
+ * caller must scan the wtmp file.  With 'query' set to IDX_QUERY_RAW the
+ * cursor returns all the records logging 'user'; with IDX_QUERY_LIST the
+ * logout records of the terminal lines used by 'user' and the system records
+ * are also returned, so that the sessions can be paired.  */
+struct wtmpindex *
+wtmpindex_open (const char *wtmpfile, const char *user, int query)
+{
+    const struct wtmplayout *layout;
+    struct wtmpindex *q = NULL;
+    struct idxfile idx;
+    struct stat sb;
+    char *path;
+    int fd;
+
+    if (!user || (path = idxpath (wtmpfile, IDX_SUFFIX)) == NULL)
+        return NULL;
+    if (!idxload (path, &idx))
+      {
+          free (path);
+          return NULL;
+      }
+    free (path);
+
+    if ((fd = open (wtmpfile, O_RDONLY)) < 0)
+      {
+          free (idx.hdr);
+          return NULL;
+      }
+    if (fstat (fd, &sb) < 0 || !fingerprintmatch (idx.hdr, &sb) ||
+        (layout = wtmplayout_probe (fd, sb.st_size)) == NULL ||
+        layout->recsize != idx.hdr->recsize ||
+        strncmp (layout->name, idx.hdr->layout, sizeof idx.hdr->layout))
+        goto error;
+
+    if ((q = calloc (1, sizeof (struct wtmpindex))) == NULL)
+        goto error;
+    q->fd = fd;
+    q->layout = layout;
+#ifdef HAVE_POSIX_FADVISE
+    /* The postings are read with scattered preads: no readahead */
+    posix_fadvise (fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+    if ((q->buf = malloc (IDX_BATCH * layout->recsize)) == NULL ||
+        (layout->decode &&
+         (q->dec = malloc (IDX_BATCH * sizeof (STRUCT_UTMP))) == NULL) ||
+        postingsmerge (q, &idx,
+                       idxfind (&idx, user, strlen (user), IDX_USER)) < 0)
+        goto error;
+
+    if (query == IDX_QUERY_LIST)
+      {
+          const STRUCT_UTMP *utp;
+          struct wtmpindex lines;
+          char (*seen)[sizeof utp->ut_line] = NULL, (*more)[sizeof utp->ut_line];
+          size_t nseen = 0, i;
+          int rc = 0;
+
+          /* First pass on the user records to find the terminal lines */
+          lines = *q;
+          while ((utp = wtmpindex_next (&lines)) != NULL)
+            {
+                if (utp->ut_type != USER_PROCESS)
+                    continue;
+                for (i = 0; i < nseen; i++)
+                    if (!strncmp (seen[i], utp->ut_line, sizeof seen[i]))
+                        break;
+                if (i < nseen)
+                    continue;
+                if ((more = realloc (seen, (nseen + 1) * sizeof seen[0]))
+                    == NULL)
+                  {
+                      rc = WTMP_ESYS;
+                      break;
+                  }
+                seen = more;
+                memcpy (seen[nseen++], utp->ut_line, sizeof seen[0]);
+            }
+          if (lines.error)
+              rc = WTMP_ESYS;
+
+          for (i = 0; i < nseen && rc == 0; i++)
+              rc = postingsmerge (q, &idx,
+                                  idxfind (&idx, seen[i], sizeof seen[i],
+                                           IDX_LINE));
+          if (rc == 0)
+              rc = postingsmerge (q, &idx, idxfind (&idx, "", 0, IDX_SYSTEM));
+          free (seen);
+          if (rc < 0)
+              goto error;
+      }
+
+    free (idx.hdr);
+    return q;
+
+  error:
+    free (idx.hdr);
+    if (q)
+        wtmpindex_close (q);
+    else
+        close (fd);
+    return NULL;
+}
+
+/* Return the next record selected by the query, or NULL at the end or on
+ * error (see wtmpindex_error).  Runs of close records are fetched with a
+ * single pread(2).  */
+STRUCT_UTMP *
+wtmpindex_next (struct wtmpindex *q)
+{
+    const size_t recsize = q->layout->recsize;
+    uint32_t recno, last;
+    size_t j;
+    ssize_t nread;
+    int prev;
+
+    if (q->next >= q->nrecs)
+        return NULL;
+
+    recno = q->recs[q->next++];
+    if (recno < q->bufstart || recno >= q->bufstart + q->buflen)
+      {
+          for (j = q->next - 1, last = recno;
+               j + 1 < q->nrecs &&
+               q->recs[j + 1] - last <= IDX_MAXGAP &&
+               q->recs[j + 1] - recno < IDX_BATCH; j++)
+              last = q->recs[j + 1];
+
+          prev = STATS_PHASE (WTMPSTATS_SCAN);
+          nread = pread (q->fd, q->buf, (size_t) (last - recno + 1) * recsize,
+                         (off_t) recno * recsize);
+          STATS_ADD (readcalls, 1);
+          if (nread < 0)
+            {
+                q->error = errno;
+                STATS_PHASE (prev);
+                return NULL;
+            }
+          STATS_ADD (bytesread, nread);
+
+          q->bufstart = recno;
+          q->buflen = nread / recsize;
+          if (q->buflen == 0)
+            {
+                STATS_PHASE (prev);
+                return NULL;
+            }
+          if (q->layout->decode)
+              q->layout->decode (q->buf, q->buflen, q->dec);
+          STATS_PHASE (prev);
+      }
+
+    STATS_ADD (scanned, 1);
+    if (q->layout->decode)
+        return &q->dec[recno - q->bufstart];
+    return (STRUCT_UTMP *) (q->buf + (size_t) (recno - q->bufstart) * recsize);
+}
+
+int
+wtmpindex_error (const struct wtmpindex *q)
+{
+    if (q->error == 0)
+        return 0;
+
+    errno = q->error;
+    return WTMP_ESYS;
+}
+
+void
+wtmpindex_close (struct wtmpindex *q)
+{
+    close (q->fd);
+    free (q->recs);
+    free (q->buf);
+    free (q->dec);
+    free (q);
+}
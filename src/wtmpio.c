@@ -0,0 +1,836 @@
+/*
+ * wtmpio.c -- A native buffered reader for wtmp files.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#ifdef HAVE_PWRITEV
+# include <sys/uio.h>
+#endif
+#include <stdint.h>
+#include <unistd.h>
+
+#include "wtmpclean.h"
+
+/* Number of records fetched from the disk with a single read(2) */
+#define WTMPREADER_NREC  1024
+
+/* Number of reads kept in flight with WTMPREADER_ASYNC */
+#define WTMPREADER_DEPTH  4
+
+/* The blocks read asynchronously, in a circle: each block is submitted
+ * again, at the first offset not yet requested, once its records have been
+ * scanned.  The blocks are made of whole records.  */
+struct wtmpasync
+{
+    struct wtmpuringreq req[WTMPREADER_DEPTH];
+    int cur;                    /* block holding the records, or -1 */
+    off_t next;                 /* offset of the next block to request */
+    int eof;                    /* the current block is the last one */
+    int broken;                 /* a read could not be waited for */
+};
+
+int wtmpreader_tail;
+
+const char *
+wtmpstrerror (int err)
+{
+    switch (err)
+      {
+      case WTMP_ESYS:
+          return strerror (errno);
+      case WTMP_ENOTREG:
+          return "the wtmp file is not a regular file";
+      case WTMP_ELAYOUT:
+          return "the wtmp file has been written with a different layout";
+      case WTMP_EREGEX:
+          return "invalid regular expression";
+      case WTMP_EJOURNAL:
+          return "not a valid undo journal";
+      case WTMP_ECHANGED:
+          return "the records have changed since the journal was written";
+      case WTMP_ERULE:
+          return "invalid anonymization rule";
+      case WTMP_EKEY:
+          return "the key file is shorter than 16 bytes";
+      case WTMP_ETRUNCATED:
+          return "the wtmp file has been truncated during the scan";
+      default:
+          return "unknown error";
+      }
+}
+
+/* Size of the window of the file read ahead, and dropped from the page cache
+ * once scanned with WTMPREADER_DONTNEED */
+#define WTMPREADER_WINDOW  (4 << 20)
+
+/* Tell the kernel which part of the file will be read next, and which part
+ * is no longer needed: 'pos' is the offset of the first byte not scanned.  */
+static void
+wtmpreader_advise (struct wtmpreader *rd, off_t pos)
+{
+#ifdef HAVE_POSIX_FADVISE
+    if (pos + WTMPREADER_WINDOW / 2 >= rd->advised)
+      {
+          posix_fadvise (rd->fd, rd->advised, WTMPREADER_WINDOW,
+                         POSIX_FADV_WILLNEED);
+          rd->advised += WTMPREADER_WINDOW;
+      }
+    if ((rd->flags & WTMPREADER_DONTNEED) &&
+        pos - rd->dropped >= WTMPREADER_WINDOW)
+      {
+          posix_fadvise (rd->fd, rd->dropped, pos - rd->dropped,
+                         POSIX_FADV_DONTNEED);
+          rd->dropped = pos;
+      }
+#endif
+}
+
+/* Fill the read buffer of 'rd' with at least one record.  Return 1 on
+ * success, 0 at the end of the file, -1 on error.  */
+static int
+wtmpreader_fill (struct wtmpreader *rd, size_t recsize)
+{
+    size_t left, want;
+    ssize_t nread;
+    long long start;
+
+    /* Keep the trailing bytes of a record split between two reads */
+    left = rd->len - rd->pos;
+    memmove (rd->buf, rd->buf + rd->pos, left);
+    rd->offset += rd->pos;
+    rd->len = left;
+    rd->pos = 0;
+    wtmpreader_advise (rd, rd->offset);
+
+    while (rd->len < recsize)
+      {
+          /* The records appended after the snapshot are left alone */
+          want = rd->bufsize - rd->len;
+          if (rd->size >= 0 && rd->offset + (off_t) (rd->len + want) > rd->size)
+              want = (rd->size > rd->offset + (off_t) rd->len) ?
+                  (size_t) (rd->size - rd->offset - rd->len) : 0;
+          if (want == 0)
+              return 0;
+
+          start = PROBE_CLOCK ();
+          nread = read (rd->fd, rd->buf + rd->len, want);
+          STATS_ADD (readcalls, 1);
+          PROBE3 (read, (long long) (rd->offset + rd->len), (long) nread,
+                  PROBE_CLOCK () - start);
+          if (nread < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                rd->error = errno;
+                return -1;
+            }
+          if (nread == 0)
+              return 0;
+          STATS_ADD (bytesread, nread);
+          rd->len += nread;
+      }
+
+    return 1;
+}
+
+/* Request the blocks starting at 'offset' */
+static void
+wtmpreader_asyncstart (struct wtmpreader *rd, off_t offset)
+{
+    struct wtmpasync *a = rd->async;
+    int i;
+
+    a->cur = -1;
+    a->next = offset;
+    a->eof = 0;
+    for (i = 0; i < WTMPREADER_DEPTH; i++)
+      {
+          a->req[i].offset = a->next;
+          a->next += rd->bufsize;
+          wtmpuring_submit (&a->req[i]);
+      }
+}
+
+/* Wait for all the reads in flight, whose buffers cannot be reused before */
+static int
+wtmpreader_asyncdrain (struct wtmpreader *rd)
+{
+    struct wtmpasync *a = rd->async;
+    int i;
+
+    for (i = 0; i < WTMPREADER_DEPTH; i++)
+        if (wtmpuring_wait (&a->req[i]) < 0)
+          {
+              a->broken = 1;
+              return WTMP_ESYS;
+          }
+
+    return 0;
+}
+
+/* Set up the asynchronous reads of 'rd', if io_uring is available */
+static int
+wtmpreader_asyncopen (struct wtmpreader *rd)
+{
+    struct wtmpasync *a;
+    int i;
+
+    if (wtmpuring_get () < 0)
+        return WTMP_ESYS;
+    if ((a = calloc (1, sizeof (struct wtmpasync))) == NULL)
+      {
+          wtmpuring_put ();
+          return WTMP_ESYS;
+      }
+
+    rd->bufsize = WTMPREADER_NREC * rd->layout->recsize;
+    for (i = 0; i < WTMPREADER_DEPTH; i++)
+      {
+          a->req[i].fd = rd->fd;
+          a->req[i].len = rd->bufsize;
+          a->req[i].done = 1;
+          if ((a->req[i].buf = malloc (rd->bufsize)) == NULL)
+            {
+                while (i-- > 0)
+                    free (a->req[i].buf);
+                free (a);
+                wtmpuring_put ();
+                return WTMP_ESYS;
+            }
+          STATS_ADD (allocs, 1);
+      }
+
+    rd->async = a;
+    wtmpreader_asyncstart (rd, 0);
+    return 0;
+}
+
+/* Make the next block read asynchronously the read buffer of 'rd'.  A read
+ * that failed or returned a short count is completed with pread, so that a
+ * block only ends with a partial record at the end of the file.  Return 1
+ * on success, 0 at the end of the file, -1 on error.  */
+static int
+wtmpreader_asyncfill (struct wtmpreader *rd, size_t recsize)
+{
+    struct wtmpasync *a = rd->async;
+    struct wtmpuringreq *req;
+    size_t len, want;
+    ssize_t nread;
+
+    if (a->cur >= 0)
+      {
+          if (a->eof)
+              return 0;
+          /* The records of the current block have been scanned */
+          req = &a->req[a->cur];
+          req->offset = a->next;
+          a->next += rd->bufsize;
+          wtmpuring_submit (req);
+      }
+    a->cur = (a->cur + 1) % WTMPREADER_DEPTH;
+    req = &a->req[a->cur];
+
+    if (wtmpuring_wait (req) < 0)
+      {
+          a->broken = 1;
+          rd->error = errno;
+          return -1;
+      }
+    STATS_ADD (readcalls, 1);
+    PROBE3 (read, (long long) req->offset, (long) req->res,
+            PROBE_CLOCK () - req->start);
+
+    /* The block is cut at the end of the snapshot */
+    want = req->len;
+    if (rd->size >= 0 && req->offset + (off_t) want >= rd->size)
+      {
+          want = (rd->size > req->offset) ?
+              (size_t) (rd->size - req->offset) : 0;
+          a->eof = 1;
+      }
+    len = (req->res > 0) ? (size_t) req->res : 0;
+    if (len > want)
+        len = want;
+    while (len < want)
+      {
+          nread = pread (rd->fd, req->buf + len, want - len,
+                         req->offset + len);
+          STATS_ADD (readcalls, 1);
+          if (nread < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                rd->error = errno;
+                return -1;
+            }
+          if (nread == 0)
+            {
+                a->eof = 1;
+                break;
+            }
+          len += nread;
+      }
+    STATS_ADD (bytesread, len);
+
+    rd->buf = req->buf;
+    rd->len = len;
+    rd->pos = 0;
+    rd->offset = req->offset;
+    wtmpreader_advise (rd, rd->offset);
+
+    return (len >= recsize);
+}
+
+/* Open 'wtmpfile' for reading.  The records are read up to the size of a
+ * regular file at the time of the call, so that a scan does not chase the
+ * records appended by the login daemons, nor returns a record being
+ * written; with WTMPREADER_TAIL the records appended during the scan are
+ * read once it is over.  With the flag WTMPREADER_MMAP the file is mapped
+ * in memory if possible; note that the mapping must not be truncated
+ * while in use.  With WTMPREADER_DONTNEED the pages scanned are dropped from
+ * the page cache, so that a scan of a large archive does not evict the data
+ * of the other processes.  With WTMPREADER_ASYNC, which takes precedence
+ * over WTMPREADER_MMAP, several large reads are kept in flight with io_uring
+ * while the records are scanned, when the kernel allows it.  */
+int
+wtmpreader_open (struct wtmpreader *rd, const char *wtmpfile, int flags)
+{
+    struct stat sb;
+    void *map;
+    int saved_errno;
+
+    memset (rd, 0, sizeof (struct wtmpreader));
+    rd->flags = flags;
+
+    if ((rd->fd = open (wtmpfile, O_RDONLY)) < 0)
+        return WTMP_ESYS;
+    if (fstat (rd->fd, &sb) < 0 ||
+        (rd->layout = wtmplayout_probe (rd->fd, sb.st_size)) == NULL)
+        goto error;
+    rd->size = S_ISREG (sb.st_mode) ?
+        sb.st_size - sb.st_size % (off_t) rd->layout->recsize : -1;
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise (rd->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    if ((flags & WTMPREADER_ASYNC) && S_ISREG (sb.st_mode) &&
+        wtmpreader_asyncopen (rd) == 0)
+        ;
+    /* A file larger than the address space is read */
+    else if ((flags & WTMPREADER_MMAP) && S_ISREG (sb.st_mode) && sb.st_size > 0
+        && (uintmax_t) sb.st_size <= SIZE_MAX
+        && (map = mmap (NULL, sb.st_size, PROT_READ, MAP_SHARED, rd->fd, 0))
+        != MAP_FAILED)
+      {
+          rd->mapped = 1;
+          rd->buf = map;
+          rd->bufsize = sb.st_size;
+          rd->len = rd->size;
+          STATS_ADD (bytesread, sb.st_size);
+#ifdef HAVE_MADVISE
+          madvise (map, sb.st_size, MADV_SEQUENTIAL);
+#endif
+      }
+    else
+      {
+          rd->bufsize = WTMPREADER_NREC * rd->layout->recsize;
+          if ((rd->buf = malloc (rd->bufsize)) == NULL)
+              goto error;
+          STATS_ADD (allocs, 1);
+      }
+
+    if (rd->layout->decode)
+      {
+          if ((rd->dec = malloc (WTMPREADER_NREC * sizeof (STRUCT_UTMP)))
+              == NULL)
+              goto error;
+          STATS_ADD (allocs, 1);
+      }
+
+    return 0;
+
+  error:
+    saved_errno = errno;
+    wtmpreader_close (rd);
+    errno = saved_errno;
+    return WTMP_ESYS;
+}
+
+/* Move the end of the snapshot of 'rd' to the last record appended to the
+ * file, once, with WTMPREADER_TAIL.  Return 1 if there are new records to
+ * read, 0 if not, -1 on error.  */
+static int
+wtmpreader_growtail (struct wtmpreader *rd)
+{
+    struct stat sb;
+    off_t size, dropped;
+    void *map;
+
+    if (!(rd->flags & WTMPREADER_TAIL) || rd->size < 0)
+        return 0;
+    rd->flags &= ~WTMPREADER_TAIL;
+
+    if (fstat (rd->fd, &sb) < 0)
+      {
+          rd->error = errno;
+          return -1;
+      }
+    size = sb.st_size - sb.st_size % (off_t) rd->layout->recsize;
+    if (size <= rd->size)
+        return 0;
+    PROBE2 (tail, (long long) rd->size, (long long) size);
+
+    if (rd->mapped)
+      {
+          if ((uintmax_t) sb.st_size > SIZE_MAX ||
+              (map = mmap (NULL, sb.st_size, PROT_READ, MAP_SHARED, rd->fd,
+                           0)) == MAP_FAILED)
+            {
+                rd->error = errno;
+                return -1;
+            }
+          STATS_ADD (bytesread, size - rd->size);
+          munmap (rd->buf, rd->bufsize);
+          rd->buf = map;
+          rd->bufsize = sb.st_size;
+          rd->len = rd->size = size;
+          return 1;
+      }
+
+    /* Go on reading after the last record of the snapshot */
+    dropped = rd->dropped;
+    if (wtmpreader_seek (rd, rd->size) < 0)
+      {
+          rd->error = errno;
+          return -1;
+      }
+    rd->dropped = dropped;
+    rd->size = size;
+
+    return 1;
+}
+
+/* Return a pointer to the next record, or NULL at the end of the file or on
+ * error (see wtmpreader_error).  The pointed data are only valid until the
+ * next call.  A partial record at the end of the file is silently ignored,
+ * as getutxent does.  Records in a foreign layout are decoded in batches.  */
+STRUCT_UTMP *
+wtmpreader_next (struct wtmpreader *rd)
+{
+    const size_t recsize = rd->layout->recsize;
+    size_t nrec;
+    int prev, rc;
+
+    if (rd->decpos < rd->ndec)
+      {
+          STATS_ADD (scanned, 1);
+          rd->recpos += recsize;
+          PROBE2 (record, (long long) (rd->offset + rd->recpos),
+                  (int) rd->dec[rd->decpos].ut_type);
+          return &rd->dec[rd->decpos++];
+      }
+
+    while (rd->len - rd->pos < recsize)
+      {
+          prev = STATS_PHASE (WTMPSTATS_SCAN);
+          if (rd->mapped)
+              rc = 0;
+          else
+              rc = rd->async ? wtmpreader_asyncfill (rd, recsize)
+                  : wtmpreader_fill (rd, recsize);
+          if (rc == 0)
+              rc = wtmpreader_growtail (rd);
+          STATS_PHASE (prev);
+          if (rc <= 0)
+              return NULL;
+      }
+
+    STATS_ADD (scanned, 1);
+    rd->recpos = rd->pos;
+    if (!rd->layout->decode)
+      {
+          rd->pos += recsize;
+          PROBE2 (record, (long long) (rd->offset + rd->recpos),
+                  (int) ((STRUCT_UTMP *) (rd->buf + rd->recpos))->ut_type);
+          return (STRUCT_UTMP *) (rd->buf + rd->recpos);
+      }
+
+    nrec = (rd->len - rd->pos) / recsize;
+    if (nrec > WTMPREADER_NREC)
+        nrec = WTMPREADER_NREC;
+    prev = STATS_PHASE (WTMPSTATS_SCAN);
+    rd->layout->decode (rd->buf + rd->pos, nrec, rd->dec);
+    STATS_PHASE (prev);
+    rd->pos += nrec * recsize;
+    rd->ndec = nrec;
+    rd->decpos = 1;
+    PROBE2 (record, (long long) (rd->offset + rd->recpos),
+            (int) rd->dec[0].ut_type);
+
+    return &rd->dec[0];
+}
+
+/* Return 0 if the last wtmpreader_next() reached the end of the file,
+ * WTMP_ESYS with errno set if it failed.  */
+int
+wtmpreader_error (const struct wtmpreader *rd)
+{
+    if (rd->error == 0)
+        return 0;
+
+    errno = rd->error;
+    return WTMP_ESYS;
+}
+
+/* Return the file offset of the record last returned by wtmpreader_next() */
+int64_t
+wtmpreader_tell (const struct wtmpreader *rd)
+{
+    return rd->offset + rd->recpos;
+}
+
+/* Reposition the reader at the file offset 'offset' */
+int
+wtmpreader_seek (struct wtmpreader *rd, int64_t offset)
+{
+    rd->ndec = rd->decpos = 0;
+    rd->recpos = 0;
+
+    if (rd->mapped)
+      {
+          rd->pos = (offset < (off_t) rd->len) ? (size_t) offset : rd->len;
+          return 0;
+      }
+
+    if (rd->async)
+      {
+          if (wtmpreader_asyncdrain (rd) < 0)
+              return WTMP_ESYS;
+          wtmpreader_asyncstart (rd, offset);
+      }
+    else if (lseek (rd->fd, offset, SEEK_SET) == (off_t) -1)
+        return WTMP_ESYS;
+
+    rd->len = rd->pos = 0;
+    rd->offset = rd->advised = rd->dropped = offset;
+    return 0;
+}
+
+void
+wtmpreader_close (struct wtmpreader *rd)
+{
+    int i;
+
+    if (rd->async)
+      {
+          /* The buffers of a read that could not be waited for are leaked,
+             the kernel might still write into them */
+          if (rd->async->broken || wtmpreader_asyncdrain (rd) < 0)
+              rd->async = NULL;
+          else
+            {
+                for (i = 0; i < WTMPREADER_DEPTH; i++)
+                    free (rd->async->req[i].buf);
+                free (rd->async);
+                rd->async = NULL;
+                wtmpuring_put ();
+            }
+      }
+    else if (rd->mapped)
+        munmap (rd->buf, rd->bufsize);
+    else
+        free (rd->buf);
+#ifdef HAVE_POSIX_FADVISE
+    /* The pages of the mapping can only be dropped once unmapped */
+    if (rd->fd >= 0 && (rd->flags & WTMPREADER_DONTNEED))
+        posix_fadvise (rd->fd, rd->dropped, 0, POSIX_FADV_DONTNEED);
+#endif
+    if (rd->fd >= 0)
+        close (rd->fd);
+    free (rd->dec);
+    rd->fd = -1;
+    rd->buf = NULL;
+    rd->dec = NULL;
+    rd->mapped = 0;
+}
+
+/* Write 'len' bytes to 'fd', retrying after a short write */
+int
+wtmpwrite (int fd, const void *data, size_t len)
+{
+    const char *p = data;
+    ssize_t nwritten;
+
+    while (len > 0)
+      {
+          nwritten = write (fd, p, len);
+          STATS_ADD (writecalls, 1);
+          if (nwritten < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return WTMP_ESYS;
+            }
+          STATS_ADD (byteswritten, nwritten);
+          p += nwritten;
+          len -= nwritten;
+      }
+
+    return 0;
+}
+
+/* Write 'len' bytes at 'offset', retrying after a short write */
+int
+wtmppwrite (int fd, const void *data, size_t len, off_t offset)
+{
+    const char *p = data;
+    ssize_t nwritten;
+
+    while (len > 0)
+      {
+          nwritten = pwrite (fd, p, len, offset);
+          STATS_ADD (writecalls, 1);
+          if (nwritten < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return WTMP_ESYS;
+            }
+          STATS_ADD (byteswritten, nwritten);
+          p += nwritten;
+          offset += nwritten;
+          len -= nwritten;
+      }
+
+    return 0;
+}
+
+/* FNV-1a hash of the 'len' bytes at 'data' */
+uint64_t
+wtmphash (const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    uint64_t h = 14695981039346656037ULL;
+
+    while (len-- > 0)
+        h = (h ^ *p++) * 1099511628211ULL;
+
+    return h;
+}
+
+/* Return the position in the 16 bytes 'addr' of a ut_addr_v6 field of the
+ * address it stores, and its family in 'family', or -1 if no address is
+ * stored */
+int
+wtmpaddrfield (const unsigned char *addr, int *family)
+{
+    static const unsigned char zero[12], mapped[12] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff
+    };
+
+    *family = AF_INET;
+    /* glibc stores an IPv4 address in the first word */
+    if (!memcmp (addr + 4, zero, 12))
+        return memcmp (addr, zero, 4) ? 0 : -1;
+    if (!memcmp (addr, mapped, 12))
+        return 12;
+
+    *family = AF_INET6;
+    return 0;
+}
+
+/* Number of adjacent patched records written with a single pwrite(2) */
+#define WRITEBACK_NREC  64
+
+#ifdef HAVE_PWRITEV
+/* Write the 'n' records 'iov' at 'offset', resuming a short write */
+static int
+wtmppwritev (int fd, struct iovec *iov, int n, off_t offset)
+{
+    ssize_t nwritten;
+
+    while (n > 0)
+      {
+          nwritten = pwritev (fd, iov, n, offset);
+          STATS_ADD (writecalls, 1);
+          if (nwritten < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return WTMP_ESYS;
+            }
+          STATS_ADD (byteswritten, nwritten);
+          offset += nwritten;
+          for (; n > 0 && (size_t) nwritten >= iov->iov_len; iov++, n--)
+              nwritten -= iov->iov_len;
+          if (n > 0)
+            {
+                iov->iov_base = (char *) iov->iov_base + nwritten;
+                iov->iov_len -= nwritten;
+            }
+      }
+
+    return 0;
+}
+#endif
+
+/* Write the records of 'patches', sorted by offset, in runs of adjacent
+ * records, gathered from the patches with pwritev(2) when available.  Add
+ * the number of records written to 'written'.  */
+int
+wtmpwriteback (int fd, const struct wtmppatch *patches, size_t npatches,
+               unsigned int *written)
+{
+#ifdef HAVE_PWRITEV
+    struct iovec run[WRITEBACK_NREC];
+#else
+    STRUCT_UTMP *run;
+#endif
+    size_t i, n;
+    long long start;
+    int rc = 0;
+
+#ifndef HAVE_PWRITEV
+    if ((run = malloc (WRITEBACK_NREC * sizeof (STRUCT_UTMP))) == NULL)
+        return WTMP_ESYS;
+    STATS_ADD (allocs, 1);
+#endif
+
+    for (i = 0; i < npatches && rc == 0; i += n)
+      {
+          for (n = 0; n < WRITEBACK_NREC && i + n < npatches &&
+               patches[i + n].offset ==
+               patches[i].offset + (off_t) (n * sizeof (STRUCT_UTMP)); n++)
+            {
+#ifdef HAVE_PWRITEV
+                run[n].iov_base = (void *) &patches[i + n].rec;
+                run[n].iov_len = sizeof (STRUCT_UTMP);
+#else
+                memcpy (&run[n], &patches[i + n].rec, sizeof (STRUCT_UTMP));
+#endif
+            }
+
+          start = PROBE_CLOCK ();
+#ifdef HAVE_PWRITEV
+          rc = wtmppwritev (fd, run, n, patches[i].offset);
+#else
+          rc = wtmppwrite (fd, run, n * sizeof (STRUCT_UTMP),
+                           patches[i].offset);
+#endif
+          PROBE3 (writeback, (long long) patches[i].offset,
+                  (int) patches[i].rec.ut_type, PROBE_CLOCK () - start);
+          if (rc == 0)
+            {
+                *written += n;
+                STATS_ADD (written, n);
+            }
+      }
+
+#ifndef HAVE_PWRITEV
+    free (run);
+#endif
+    return rc;
+}
+
+/* Set up a buffered writer of 'bufsize' bytes on 'fd' */
+int
+wtmpwriter_open (struct wtmpwriter *wr, int fd, size_t bufsize)
+{
+    wr->fd = fd;
+    wr->len = 0;
+    wr->size = bufsize;
+    wr->offset = 0;
+    if ((wr->buf = malloc (bufsize)) == NULL)
+        return WTMP_ESYS;
+    STATS_ADD (allocs, 1);
+
+    return 0;
+}
+
+/* Write the buffered bytes at the end of the data written so far */
+int
+wtmpwriter_flush (struct wtmpwriter *wr)
+{
+    if (wr->len == 0)
+        return 0;
+    if (wtmppwrite (wr->fd, wr->buf, wr->len, wr->offset) < 0)
+        return WTMP_ESYS;
+
+    wr->offset += wr->len;
+    wr->len = 0;
+    return 0;
+}
+
+/* Append the 'len' bytes at 'data' */
+int
+wtmpwriter_put (struct wtmpwriter *wr, const void *data, size_t len)
+{
+    if (wr->len + len > wr->size && wtmpwriter_flush (wr) < 0)
+        return WTMP_ESYS;
+    if (len > wr->size)
+      {
+          /* Too large for the buffer: write it through */
+          if (wtmppwrite (wr->fd, data, len, wr->offset) < 0)
+              return WTMP_ESYS;
+          wr->offset += len;
+          return 0;
+      }
+
+    memcpy (wr->buf + wr->len, data, len);
+    wr->len += len;
+    return 0;
+}
+
+/* Flush and free the buffer; the file descriptor is left open */
+int
+wtmpwriter_close (struct wtmpwriter *wr)
+{
+    int rc = wtmpwriter_flush (wr);
+
+    free (wr->buf);
+    wr->buf = NULL;
+    return rc;
+}
@@ -0,0 +1,294 @@
+/*
+ * wtmpjournal.c -- Undo journal of the edits.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Before wtmpedit() patches a wtmp file it appends to the undo journal a
+ * block made of a header, with the fingerprint of the file, and of one
+ * entry per patched record:
+ *
+ *   header   magic, version, record size, number of entries, dev, inode
+ *            and size of the wtmp file, time of the edit
+ *   entry    offset of the record, hash of the record written, original
+ *            record bytes
+ *
+ * wtmprevert() restores the original records with positioned writes, from
+ * the last block to the first one, after checking that the records still
+ * hold what the edit wrote (or are already restored).  Each block restored
+ * is cut from the journal, so that a revert stopped by a changed record can
+ * be retried from there.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+#ifdef HAVE_STRINGS_H
+# include <strings.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "wtmpclean.h"
+
+#define JOURNAL_MAGIC    "WTMPUNDO"
+#define JOURNAL_VERSION  1
+
+struct journalheader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t recsize;
+    uint64_t nentries;
+    uint64_t dev, ino, size;
+    int64_t time;
+};
+
+struct journalentry
+{
+    uint64_t offset;
+    uint64_t hash;              /* hash of the patched record */
+    /* followed by the 'recsize' bytes of the original record */
+};
+
+/* Append to 'journal' the original content of the records about to be
+ * patched in the wtmp file described by 'sb', and flush it to disk.  */
+int
+wtmpjournal_append (const char *journal, const struct stat *sb,
+                    const struct wtmppatch *patches, size_t npatches)
+{
+    const size_t entsize = sizeof (struct journalentry) + sizeof (STRUCT_UTMP);
+    struct journalheader hdr;
+    struct journalentry ent;
+    char *buf, *p;
+    size_t i, len;
+    int fd, rc, saved_errno;
+
+    len = sizeof hdr + npatches * entsize;
+    if ((buf = malloc (len)) == NULL)
+        return WTMP_ESYS;
+
+    memset (&hdr, 0, sizeof hdr);
+    memcpy (hdr.magic, JOURNAL_MAGIC, sizeof hdr.magic);
+    hdr.version = JOURNAL_VERSION;
+    hdr.recsize = sizeof (STRUCT_UTMP);
+    hdr.nentries = npatches;
+    hdr.dev = sb->st_dev;
+    hdr.ino = sb->st_ino;
+    hdr.size = sb->st_size;
+    hdr.time = time (NULL);
+    memcpy (buf, &hdr, sizeof hdr);
+
+    for (i = 0, p = buf + sizeof hdr; i < npatches; i++, p += entsize)
+      {
+          ent.offset = patches[i].offset;
+          ent.hash = wtmphash (&patches[i].rec, sizeof (STRUCT_UTMP));
+          memcpy (p, &ent, sizeof ent);
+          memcpy (p + sizeof ent, &patches[i].orig, sizeof (STRUCT_UTMP));
+      }
+
+    /* The journal keeps the records hidden by the edit */
+    if ((fd = open (journal, O_WRONLY | O_APPEND | O_CREAT, 0600)) < 0)
+      {
+          free (buf);
+          return WTMP_ESYS;
+      }
+    rc = wtmpwrite (fd, buf, len);
+    if (rc == 0 && fsync (fd) < 0)
+        rc = WTMP_ESYS;
+
+    saved_errno = errno;
+    if (close (fd) < 0 && rc == 0)
+        rc = WTMP_ESYS;
+    else
+        errno = saved_errno;
+    free (buf);
+
+    return rc;
+}
+
+/* Restore the records of 'wtmpfile' saved in the undo 'journal', undoing
+ * the edits from the most recent one.  The journal is truncated after each
+ * edit undone and removed once all the records are restored.  Set 'nrec'
+ * to the number of records restored and return 0 or a WTMP_E* error code.  */
+int
+wtmprevert (const char *wtmpfile, const char *journal, unsigned int *nrec)
+{
+    const struct journalheader *hdr;
+    const struct journalentry *ent;
+    const char **blocks = NULL, **more;
+    STRUCT_UTMP cur;
+    struct stat sb, jsb;
+    struct utimbuf currtime;
+    struct flock lock;
+    size_t nblocks = 0, pos, entsize, n, i;
+    char *data = NULL;
+    ssize_t nread;
+    int fd = -1, jfd, rc = WTMP_ESYS, saved_errno;
+
+    *nrec = 0;
+
+    /* Load the whole journal: it only holds the patched records */
+    if ((jfd = open (journal, O_RDONLY)) < 0)
+        return WTMP_ESYS;
+    if (fstat (jfd, &jsb) < 0 || (data = malloc (jsb.st_size + 1)) == NULL)
+      {
+          close (jfd);
+          return WTMP_ESYS;
+      }
+    nread = read (jfd, data, jsb.st_size);
+    saved_errno = errno;
+    close (jfd);
+    errno = saved_errno;
+    if (nread < 0)
+        goto out;
+
+    /* Split the journal into the blocks written by each edit */
+    rc = WTMP_EJOURNAL;
+    for (pos = 0; pos < (size_t) nread; pos += sizeof (*hdr) + n * entsize)
+      {
+          hdr = (const struct journalheader *) (data + pos);
+          if ((size_t) nread - pos < sizeof (*hdr) ||
+              memcmp (hdr->magic, JOURNAL_MAGIC, sizeof hdr->magic) ||
+              hdr->version != JOURNAL_VERSION ||
+              hdr->recsize != sizeof (STRUCT_UTMP))
+              goto out;
+          entsize = sizeof (struct journalentry) + hdr->recsize;
+          n = hdr->nentries;
+          if (n > ((size_t) nread - pos - sizeof (*hdr)) / entsize)
+              goto out;
+
+          if ((more = realloc (blocks, (nblocks + 1) * sizeof (*blocks)))
+              == NULL)
+            {
+                rc = WTMP_ESYS;
+                goto out;
+            }
+          blocks = more;
+          blocks[nblocks++] = data + pos;
+      }
+    if (nblocks == 0)
+        goto out;
+
+    rc = WTMP_ESYS;
+    if ((fd = open (wtmpfile, O_RDWR)) < 0)
+        goto out;
+    memset (&lock, 0, sizeof lock);
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    if (fcntl (fd, F_SETLKW, &lock) < 0 || fstat (fd, &sb) < 0)
+        goto out;
+    if (!S_ISREG (sb.st_mode))
+      {
+          rc = WTMP_ENOTREG;
+          goto out;
+      }
+    currtime.actime = sb.st_atime;
+    currtime.modtime = sb.st_mtime;
+
+    while (nblocks-- > 0)
+      {
+          hdr = (const struct journalheader *) blocks[nblocks];
+          entsize = sizeof (struct journalentry) + hdr->recsize;
+
+          /* The records must still hold what the edit wrote, or already
+             hold their original content, after an edit whose write-back
+             failed or a revert interrupted: the wtmp file can only have
+             grown since then */
+          rc = WTMP_ECHANGED;
+          if (hdr->dev != (uint64_t) sb.st_dev ||
+              hdr->ino != (uint64_t) sb.st_ino ||
+              hdr->size > (uint64_t) sb.st_size)
+              goto out;
+          for (i = 0; i < hdr->nentries; i++)
+            {
+                ent = (const struct journalentry *)
+                    ((const char *) (hdr + 1) + i * entsize);
+                if (ent->offset + hdr->recsize > (uint64_t) sb.st_size ||
+                    pread (fd, &cur, sizeof cur, ent->offset) != sizeof cur)
+                    goto out;
+                if (wtmphash (&cur, sizeof cur) != ent->hash &&
+                    memcmp (&cur, ent + 1, sizeof cur))
+                    goto out;
+            }
+
+          for (i = 0; i < hdr->nentries; i++)
+            {
+                ent = (const struct journalentry *)
+                    ((const char *) (hdr + 1) + i * entsize);
+                if ((rc = wtmppwrite (fd, ent + 1, hdr->recsize,
+                                     ent->offset)) < 0)
+                    goto out;
+                (*nrec)++;
+            }
+
+          /* The block must not be replayed by a new attempt */
+          rc = WTMP_ESYS;
+          if (fsync (fd) < 0 || truncate (journal, blocks[nblocks] - data) < 0)
+              goto out;
+      }
+
+    rc = 0;
+    if (unlink (journal) < 0)
+        rc = WTMP_ESYS;
+
+  out:
+    saved_errno = errno;
+    if (*nrec > 0)
+      {
+          /* The sidecar index no longer describes the restored records */
+          wtmpindex_remove (wtmpfile);
+          wtmpgeneration_bump (wtmpfile);
+          if (fchown (fd, sb.st_uid, sb.st_gid) < 0)
+              errno = 0;
+          if (utime (wtmpfile, &currtime) < 0)
+              errno = 0;
+      }
+    if (fd >= 0)
+        close (fd);             /* also releases the lock */
+    free (blocks);
+    free (data);
+    errno = saved_errno;
+
+    return rc;
+}
@@ -0,0 +1,352 @@
+/*
+ * wtmplastlog.c -- Rebuild the lastlog file from the wtmp files.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The lastlog file is an array of struct lastlog indexed by UID, usually
+ * sparse: the slots of the UIDs never logged in are holes.  The last login
+ * of each user is taken from the wtmp files in a single pass, the UIDs of
+ * all the users are resolved in one batch, and only the slots that change
+ * are written, with a pwrite(2) each, so that the holes are preserved.
+ *
+ * The wtmp files are authoritative for the period they cover: a slot whose
+ * login falls in that period but that does not match the last login found
+ * in the files (a login renamed or deleted by an edit) is rewritten, or
+ * cleared if the user has no login left.  The logins before and after the
+ * period are kept, unless the files show a later one.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#define _GNU_SOURCE             /* SEEK_DATA, SEEK_HOLE */
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_LASTLOG_H
+# include <lastlog.h>
+#endif
+#ifdef HAVE_UTMP_H
+# include <utmp.h>
+#endif
+
+#include "wtmpclean.h"
+
+#ifdef HAVE_STRUCT_LASTLOG
+
+#define LASTLOG_HASHSIZE  1021
+#define LASTLOG_NSLOTS    1024  /* slots read at once by the sweep */
+
+/* The last login of a user */
+struct lastuser
+{
+    char name[sizeof (UT_USER ((STRUCT_UTMP *) 0)) + 1];
+    time_t time;
+    char line[sizeof (((STRUCT_UTMP *) 0)->ut_line)];
+    char host[sizeof (((STRUCT_UTMP *) 0)->ut_host)];
+    struct lastuser *next;
+};
+
+/* A slot to be written */
+struct lastslot
+{
+    uid_t uid;
+    const struct lastuser *user;
+};
+
+static int
+byuid (const void *a, const void *b)
+{
+    const struct lastslot *x = a, *y = b;
+
+    return x->uid < y->uid ? -1 : x->uid > y->uid;
+}
+
+static void
+fillslot (struct lastlog *ll, const struct lastuser *u)
+{
+    memset (ll, 0, sizeof (struct lastlog));
+    ll->ll_time = u->time;
+    memcpy (ll->ll_line, u->line,
+            sizeof ll->ll_line < sizeof u->line ?
+            sizeof ll->ll_line : sizeof u->line);
+    memcpy (ll->ll_host, u->host,
+            sizeof ll->ll_host < sizeof u->host ?
+            sizeof ll->ll_host : sizeof u->host);
+}
+
+/* Clear the slots of the lastlog file 'fd' of 'size' bytes that hold a
+ * login in [tmin, tmax] and do not belong to one of the 'nslots' users
+ * found, reading only the data regions of the file.  A partial slot at the
+ * end of the file is left alone.  Return the number of slots cleared.  */
+static unsigned int
+sweep (const char *lastlogfile, int fd, off_t size, time_t tmin, time_t tmax,
+       const struct lastslot *slots, size_t nslots)
+{
+    static const struct lastlog zero;
+    struct lastlog *buf;
+    struct lastslot key;
+    off_t data = 0, hole, pos;
+    ssize_t nread;
+    unsigned int ncleared = 0;
+    size_t i, n;
+
+    if ((buf = malloc (LASTLOG_NSLOTS * sizeof (struct lastlog))) == NULL)
+        die (errno, "out of memory");
+
+    size -= size % sizeof (struct lastlog);
+    while (data < size)
+      {
+#ifdef SEEK_DATA
+          /* Skip the holes: a filesystem without support reports the whole
+             file as data */
+          if ((data = lseek (fd, data, SEEK_DATA)) < 0)
+            {
+                if (errno == ENXIO)
+                    break;
+                die (errno, "%s: cannot seek", lastlogfile);
+            }
+          if ((hole = lseek (fd, data, SEEK_HOLE)) < 0)
+              die (errno, "%s: cannot seek", lastlogfile);
+#else
+          hole = size;
+#endif
+          if (hole > size)
+              hole = size;
+          data -= data % sizeof (struct lastlog);
+
+          for (pos = data; pos < hole; pos += n * sizeof (struct lastlog))
+            {
+                n = (hole - pos + sizeof (struct lastlog) - 1) /
+                    sizeof (struct lastlog);
+                if (n > LASTLOG_NSLOTS)
+                    n = LASTLOG_NSLOTS;
+                if ((nread = pread (fd, buf, n * sizeof (struct lastlog),
+                                    pos)) < 0)
+                    die (errno, "%s: read error", lastlogfile);
+                STATS_ADD (readcalls, 1);
+                STATS_ADD (bytesread, nread);
+                n = nread / sizeof (struct lastlog);
+                if (n == 0)
+                  {
+                      pos = size;       /* the file has been truncated */
+                      break;
+                  }
+
+                for (i = 0; i < n; i++)
+                  {
+                      if (buf[i].ll_time < tmin || buf[i].ll_time > tmax ||
+                          buf[i].ll_time == 0)
+                          continue;
+                      key.uid = pos / sizeof (struct lastlog) + i;
+                      if (bsearch (&key, slots, nslots,
+                                   sizeof (struct lastslot), byuid))
+                          continue;
+                      if (wtmppwrite (fd, &zero, sizeof zero,
+                                      pos + i * sizeof (struct lastlog)) < 0)
+                          die (errno, "%s: write error", lastlogfile);
+                      ncleared++;
+                  }
+            }
+          data = pos;
+      }
+
+    free (buf);
+    return ncleared;
+}
+
+/* Rewrite the slots of 'lastlogfile' (LASTLOG_FILE if NULL) with the last
+ * login of each user found in the 'nfiles' wtmp files 'wtmpfiles'.  */
+void
+wtmplastlog (const char *lastlogfile, char *const *wtmpfiles, int nfiles)
+{
+    struct lastuser *table[LASTLOG_HASHSIZE], *u, *next;
+    struct lastslot *slots;
+    struct lastlog ll, old;
+    struct wtmpreader rd;
+    struct flock lock;
+    struct stat sb;
+    STRUCT_UTMP *utp;
+    const char **names;
+    time_t t, tmin = 0, tmax = 0;
+    unsigned int h, nchanged = 0, ncleared, nunknown = 0;
+    size_t nusers = 0, nslots = 0, i;
+    off_t offset;
+    int fd, f, rc;
+
+    if (!lastlogfile)
+        lastlogfile = LASTLOG_FILE;
+    memset (table, 0, sizeof table);
+
+    STATS_PHASE (WTMPSTATS_SCAN);
+    for (f = 0; f < nfiles; f++)
+      {
+          if ((rc = wtmpreader_open (&rd, wtmpfiles[f],
+                                     WTMPREADER_ASYNC | WTMPREADER_MMAP |
+                                     WTMPREADER_DONTNEED)) < 0)
+              die (0, "%s: %s", wtmpfiles[f], wtmpstrerror (rc));
+
+          while ((utp = wtmpreader_next (&rd)) != NULL)
+            {
+                if ((t = UT_TIME_MEMBER (utp)) > 0)
+                  {
+                      if (tmin == 0 || t < tmin)
+                          tmin = t;
+                      if (t > tmax)
+                          tmax = t;
+                  }
+                if (utp->ut_type != USER_PROCESS || !UT_USER (utp)[0])
+                    continue;
+
+                h = 0;
+                for (i = 0; i < sizeof (UT_USER (utp)) && UT_USER (utp)[i];
+                     i++)
+                    h = h * 31 + (unsigned char) UT_USER (utp)[i];
+                h %= LASTLOG_HASHSIZE;
+                for (u = table[h]; u; u = u->next)
+                    if (!strncmp (u->name, UT_USER (utp),
+                                  sizeof (UT_USER (utp))))
+                        break;
+                if (!u)
+                  {
+                      if ((u = calloc (1, sizeof (struct lastuser))) == NULL)
+                          die (errno, "out of memory");
+                      STATS_ADD (allocs, 1);
+                      strncpy (u->name, UT_USER (utp), sizeof u->name - 1);
+                      u->next = table[h];
+                      table[h] = u;
+                      nusers++;
+                  }
+                else if (t < u->time)
+                    continue;
+
+                STATS_ADD (matched, 1);
+                u->time = t;
+                memcpy (u->line, utp->ut_line, sizeof u->line);
+                memcpy (u->host, utp->ut_host, sizeof u->host);
+            }
+          if (wtmpreader_error (&rd) < 0)
+              die (errno, "error while reading %s", wtmpfiles[f]);
+          wtmpreader_close (&rd);
+      }
+
+    /* One batch of lookups for all the users */
+    STATS_PHASE (WTMPSTATS_PAIR);
+    if ((names = malloc ((nusers + 1) * sizeof (char *))) == NULL ||
+        (slots = malloc ((nusers + 1) * sizeof (struct lastslot))) == NULL)
+        die (errno, "out of memory");
+    for (h = 0, i = 0; h < LASTLOG_HASHSIZE; h++)
+        for (u = table[h]; u; u = u->next)
+            names[i++] = u->name;
+    usercache_resolve (names, nusers);
+    for (h = 0; h < LASTLOG_HASHSIZE; h++)
+        for (u = table[h]; u; u = u->next)
+            if (usercache_uid (u->name, &slots[nslots].uid))
+                slots[nslots++].user = u;
+            else
+                nunknown++;
+    qsort (slots, nslots, sizeof (struct lastslot), byuid);
+
+    STATS_PHASE (WTMPSTATS_WRITEBACK);
+    if ((fd = open (lastlogfile, O_RDWR | O_CREAT, 0644)) < 0)
+        die (errno, "cannot open %s", lastlogfile);
+    memset (&lock, 0, sizeof lock);
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    if (fcntl (fd, F_SETLKW, &lock) < 0 || fstat (fd, &sb) < 0)
+        die (errno, "cannot lock %s", lastlogfile);
+
+    ncleared = sweep (lastlogfile, fd, sb.st_size, tmin, tmax, slots, nslots);
+
+    /* The slots are written in the order of the file */
+    for (i = 0; i < nslots; i++)
+      {
+          offset = (off_t) slots[i].uid * sizeof (struct lastlog);
+          memset (&old, 0, sizeof old);
+          if (offset < sb.st_size &&
+              pread (fd, &old, sizeof old, offset) < 0)
+              die (errno, "%s: read error", lastlogfile);
+
+          /* Keep a later login, from after the wtmp files */
+          if (old.ll_time > tmax && old.ll_time > slots[i].user->time)
+              continue;
+          fillslot (&ll, slots[i].user);
+          if (!memcmp (&ll, &old, sizeof ll))
+              continue;
+          if (wtmppwrite (fd, &ll, sizeof ll, offset) < 0)
+              die (errno, "%s: write error", lastlogfile);
+          STATS_ADD (written, 1);
+          nchanged++;
+      }
+
+    if (fsync (fd) < 0 || close (fd) < 0)
+        die (errno, "%s: write error", lastlogfile);
+    STATS_PHASE (WTMPSTATS_NONE);
+
+    printf ("%s: %u slot(s) updated, %u cleared", lastlogfile, nchanged,
+            ncleared);
+    if (nunknown)
+        printf (", %u unknown user(s) skipped", nunknown);
+    printf (".\n");
+
+    for (h = 0; h < LASTLOG_HASHSIZE; h++)
+        for (u = table[h]; u; u = next)
+          {
+              next = u->next;
+              free (u);
+          }
+    free (names);
+    free (slots);
+}
+
+#else /* !HAVE_STRUCT_LASTLOG */
+
+void
+wtmplastlog (const char *lastlogfile, char *const *wtmpfiles, int nfiles)
+{
+    (void) wtmpfiles;
+    (void) nfiles;
+    die (0, "%s: the lastlog file is not supported on this system",
+         lastlogfile ? lastlogfile : LASTLOG_FILE);
+}
+
+#endif
@@ -0,0 +1,313 @@
+/*
+ * wtmplayout.c -- Decoders for the wtmp layouts of other platforms.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Archives copied from other hosts can use a record layout that differs from
+ * the one of STRUCT_UTMP.  Each known layout has a decoder that translates
+ * a batch of records into STRUCT_UTMP's with a loop over fixed offsets.
+ * The layout of a file is chosen at runtime by probing its first records.
+ *
+ *   linux-32     glibc with 32-bit ut_session and ut_tv (x86, x86_64,
+ *                arm, ...): 384 bytes
+ *   linux-64     glibc and musl with 64-bit ut_session and ut_tv
+ *                (aarch64, ppc64, s390x, musl time64, ...): 400 bytes
+ *   solaris      Solaris wtmpx (struct futmpx): 372 bytes
+ *
+ * each one in little endian (le) and big endian (be) byte order.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "wtmpclean.h"
+
+/* Number of records examined to guess the layout of a file */
+#define PROBE_NREC  64
+
+/* Plausible range of the timestamps: 1980 - 2100 */
+#define PROBE_MINTIME  315532800L
+#define PROBE_MAXTIME  4102444800LL
+
+static inline uint16_t
+get16 (const char *p, int be)
+{
+    const unsigned char *u = (const unsigned char *) p;
+
+    return be ? (uint16_t) (u[0] << 8 | u[1]) : (uint16_t) (u[1] << 8 | u[0]);
+}
+
+static inline uint32_t
+get32 (const char *p, int be)
+{
+    const unsigned char *u = (const unsigned char *) p;
+
+    return be ? ((uint32_t) u[0] << 24 | (uint32_t) u[1] << 16 |
+                 (uint32_t) u[2] << 8 | u[3])
+        : ((uint32_t) u[3] << 24 | (uint32_t) u[2] << 16 |
+           (uint32_t) u[1] << 8 | u[0]);
+}
+
+static inline uint64_t
+get64 (const char *p, int be)
+{
+    return be ? ((uint64_t) get32 (p, 1) << 32 | get32 (p + 4, 1))
+        : ((uint64_t) get32 (p + 4, 0) << 32 | get32 (p, 0));
+}
+
+static inline void
+putstr (char *dst, size_t dstlen, const char *src, size_t srclen)
+{
+    if (srclen >= dstlen)
+        memcpy (dst, src, dstlen);
+    else
+      {
+          memcpy (dst, src, srclen);
+          memset (dst + srclen, 0, dstlen - srclen);
+      }
+}
+
+/* glibc layout, see <bits/utmpx.h>:
+ *   0 ut_type   4 ut_pid   8 ut_line   40 ut_id   44 ut_user   76 ut_host
+ *   332 ut_exit   336 ut_session   then ut_tv and ut_addr_v6  */
+static inline void
+decode_linux (const char *src, size_t nrec, STRUCT_UTMP *dst,
+              const int time64, const int be)
+{
+    const size_t recsize = time64 ? 400 : 384;
+    const size_t tv = time64 ? 344 : 340;
+    const size_t addr = time64 ? 360 : 348;
+    size_t i;
+
+    for (i = 0; i < nrec; i++, src += recsize, dst++)
+      {
+          memset (dst, 0, sizeof (STRUCT_UTMP));
+          dst->ut_type = (int16_t) get16 (src, be);
+          dst->ut_pid = (int32_t) get32 (src + 4, be);
+          putstr (dst->ut_line, sizeof dst->ut_line, src + 8, 32);
+          putstr (dst->ut_id, sizeof dst->ut_id, src + 40, 4);
+          putstr (UT_USER (dst), sizeof (UT_USER (dst)), src + 44, 32);
+          putstr (dst->ut_host, sizeof dst->ut_host, src + 76, 256);
+#ifdef __GLIBC__
+          dst->ut_exit.e_termination = (int16_t) get16 (src + 332, be);
+          dst->ut_exit.e_exit = (int16_t) get16 (src + 334, be);
+          dst->ut_session = time64 ? (int64_t) get64 (src + 336, be)
+              : (int32_t) get32 (src + 336, be);
+#endif
+          dst->ut_tv.tv_sec = time64 ? (int64_t) get64 (src + tv, be)
+              : (int32_t) get32 (src + tv, be);
+          dst->ut_tv.tv_usec = time64 ? (int64_t) get64 (src + tv + 8, be)
+              : (int32_t) get32 (src + tv + 4, be);
+#ifdef HAVE_UTP_UT_ADDR_V6
+          /* The address is stored in network byte order */
+          memcpy (dst->ut_addr_v6, src + addr, 16);
+#endif
+      }
+}
+
+/* Solaris struct futmpx, see <utmpx.h>:
+ *   0 ut_user   32 ut_id   36 ut_line   68 ut_pid   72 ut_type   74 ut_exit
+ *   80 ut_tv   88 ut_session   92 pad[5]   112 ut_syslen   114 ut_host  */
+static inline void
+decode_solaris (const char *src, size_t nrec, STRUCT_UTMP *dst, const int be)
+{
+    const size_t recsize = 372;
+    size_t i;
+
+    for (i = 0; i < nrec; i++, src += recsize, dst++)
+      {
+          memset (dst, 0, sizeof (STRUCT_UTMP));
+          putstr (UT_USER (dst), sizeof (UT_USER (dst)), src, 32);
+          putstr (dst->ut_id, sizeof dst->ut_id, src + 32, 4);
+          putstr (dst->ut_line, sizeof dst->ut_line, src + 36, 32);
+          dst->ut_pid = (int32_t) get32 (src + 68, be);
+          dst->ut_type = (int16_t) get16 (src + 72, be);
+#ifdef __GLIBC__
+          dst->ut_exit.e_termination = (int16_t) get16 (src + 74, be);
+          dst->ut_exit.e_exit = (int16_t) get16 (src + 76, be);
+          dst->ut_session = (int32_t) get32 (src + 88, be);
+#endif
+          dst->ut_tv.tv_sec = (int32_t) get32 (src + 80, be);
+          dst->ut_tv.tv_usec = (int32_t) get32 (src + 84, be);
+          putstr (dst->ut_host, sizeof dst->ut_host, src + 114, 257);
+      }
+}
+
+static void
+decode_linux32le (const char *src, size_t nrec, STRUCT_UTMP *dst)
+{
+    decode_linux (src, nrec, dst, 0, 0);
+}
+
+static void
+decode_linux32be (const char *src, size_t nrec, STRUCT_UTMP *dst)
+{
+    decode_linux (src, nrec, dst, 0, 1);
+}
+
+static void
+decode_linux64le (const char *src, size_t nrec, STRUCT_UTMP *dst)
+{
+    decode_linux (src, nrec, dst, 1, 0);
+}
+
+static void
+decode_linux64be (const char *src, size_t nrec, STRUCT_UTMP *dst)
+{
+    decode_linux (src, nrec, dst, 1, 1);
+}
+
+static void
+decode_solarisle (const char *src, size_t nrec, STRUCT_UTMP *dst)
+{
+    decode_solaris (src, nrec, dst, 0);
+}
+
+static void
+decode_solarisbe (const char *src, size_t nrec, STRUCT_UTMP *dst)
+{
+    decode_solaris (src, nrec, dst, 1);
+}
+
+/* The native layout comes first: it wins when several layouts fit */
+static const struct wtmplayout layouts[] = {
+    {"native", sizeof (STRUCT_UTMP), NULL},
+    {"linux-32le", 384, decode_linux32le},
+    {"linux-32be", 384, decode_linux32be},
+    {"linux-64le", 400, decode_linux64le},
+    {"linux-64be", 400, decode_linux64be},
+    {"solaris-le", 372, decode_solarisle},
+    {"solaris-be", 372, decode_solarisbe},
+    {NULL, 0, NULL}
+};
+
+const struct wtmplayout *
+wtmplayout_native (void)
+{
+    return &layouts[0];
+}
+
+/* Return 1 if 'p' is a printable string padded with null bytes */
+static int
+sanestring (const char *p, size_t len)
+{
+    size_t i = 0;
+
+    for (; i < len && p[i]; i++)
+        if ((unsigned char) p[i] < 0x20 || p[i] == 0x7f)
+            return 0;
+    for (; i < len; i++)
+        if (p[i])
+            return 0;
+
+    return 1;
+}
+
+static int
+sanerecord (const STRUCT_UTMP *utp)
+{
+    long long t = UT_TIME_MEMBER (utp);
+
+    if (utp->ut_type < EMPTY || utp->ut_type > UT_TYPE_MAX)
+        return 0;
+    if (utp->ut_type == EMPTY)
+        return 1;
+    if (t < PROBE_MINTIME || t > PROBE_MAXTIME ||
+        utp->ut_tv.tv_usec < 0 || utp->ut_tv.tv_usec >= 1000000)
+        return 0;
+    if (UT_PID (utp) < 0)
+        return 0;
+
+    return sanestring (utp->ut_line, sizeof utp->ut_line) &&
+        sanestring (UT_USER (utp), sizeof (UT_USER (utp)));
+}
+
+/* Guess the layout of the wtmp file open on 'fd', whose size is 'size', by
+ * counting the plausible records at the beginning of the file for each
+ * known layout.  Return NULL if the file cannot be read.  */
+const struct wtmplayout *
+wtmplayout_probe (int fd, int64_t size)
+{
+    const struct wtmplayout *best = &layouts[0];
+    STRUCT_UTMP dec[PROBE_NREC];
+    char *buf;
+    size_t bufsize, nrec, i;
+    ssize_t nread;
+    int l, score, bestscore = -1;
+
+    bufsize = PROBE_NREC * 400;
+    if ((buf = malloc (bufsize)) == NULL)
+        return NULL;
+    if ((nread = pread (fd, buf, bufsize, 0)) < 0)
+      {
+          free (buf);
+          return NULL;
+      }
+
+    for (l = 0; layouts[l].name; l++)
+      {
+          nrec = (size_t) nread / layouts[l].recsize;
+          if (nrec > PROBE_NREC)
+              nrec = PROBE_NREC;
+          if (nrec == 0)
+              continue;
+
+          if (layouts[l].decode)
+              layouts[l].decode (buf, nrec, dec);
+          else
+              memcpy (dec, buf, nrec * sizeof (STRUCT_UTMP));
+
+          for (i = 0, score = 0; i < nrec; i++)
+              score += 2 * sanerecord (&dec[i]);
+          /* A file made of whole records is a hint */
+          if (size % layouts[l].recsize == 0)
+              score++;
+
+          if (score > bestscore)
+            {
+                best = &layouts[l];
+                bestscore = score;
+            }
+      }
+
+    free (buf);
+    return best;
+}
@@ -0,0 +1,263 @@
+/*
+ * wtmpmerge.c -- Time-ordered merge of several wtmp files.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Each input file is already in time order, so the inputs are streamed
+ * through a binary heap holding the next record of every file, keyed on
+ * ut_tv (and on the position of the file in the command line, so that the
+ * records with the same time keep the order of the inputs).  The memory
+ * used does not depend on the size of the files: a read buffer per input,
+ * the heap, a write buffer and the window of the duplicates.
+ *
+ * Overlapping files (a rotated file and a backup of it) contain the same
+ * records: with WTMPMERGE_DEDUP a record equal, byte by byte, to a record
+ * already written with the same time is dropped.  The records written
+ * with the current time are kept in a small window, cleared when the time
+ * changes.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "wtmpclean.h"
+
+/* Size of the write buffer, in records */
+#define MERGE_NREC    1024
+
+/* Maximum number of records with the same time checked for duplicates */
+#define DEDUP_WINDOW  256
+
+struct mergein
+{
+    struct wtmpreader rd;
+    STRUCT_UTMP *utp;           /* next record, or NULL at end of file */
+    int open;
+};
+
+struct dedup
+{
+    uint32_t hash[DEDUP_WINDOW];
+    STRUCT_UTMP rec[DEDUP_WINDOW];
+    size_t n, next;             /* next is the slot reused when full */
+};
+
+/* Return 1 if the next record of 'a' comes before the one of 'b' */
+static inline int
+before (const struct mergein *in, int a, int b)
+{
+    const STRUCT_UTMP *x = in[a].utp, *y = in[b].utp;
+
+    if (x->ut_tv.tv_sec != y->ut_tv.tv_sec)
+        return x->ut_tv.tv_sec < y->ut_tv.tv_sec;
+    if (x->ut_tv.tv_usec != y->ut_tv.tv_usec)
+        return x->ut_tv.tv_usec < y->ut_tv.tv_usec;
+    return a < b;
+}
+
+static void
+siftdown (const struct mergein *in, int *heap, int n, int i)
+{
+    int child, top = heap[i];
+
+    while ((child = 2 * i + 1) < n)
+      {
+          if (child + 1 < n && before (in, heap[child + 1], heap[child]))
+              child++;
+          if (!before (in, heap[child], top))
+              break;
+          heap[i] = heap[child];
+          i = child;
+      }
+    heap[i] = top;
+}
+
+/* Return 1 if 'utp' has already been written, and remember it otherwise.
+ * The window only holds the records of the time of 'utp'.  */
+static int
+duplicate (struct dedup *dd, const STRUCT_UTMP *utp)
+{
+    uint32_t h = (uint32_t) wtmphash (utp, sizeof (STRUCT_UTMP));
+    size_t i;
+
+    if (dd->n > 0 &&
+        (dd->rec[0].ut_tv.tv_sec != utp->ut_tv.tv_sec ||
+         dd->rec[0].ut_tv.tv_usec != utp->ut_tv.tv_usec))
+        dd->n = dd->next = 0;
+
+    for (i = 0; i < dd->n; i++)
+        if (dd->hash[i] == h && !memcmp (&dd->rec[i], utp, sizeof (STRUCT_UTMP)))
+            return 1;
+
+    if (dd->n < DEDUP_WINDOW)
+        i = dd->n++;
+    else
+        i = dd->next;
+    dd->next = (i + 1) % DEDUP_WINDOW;
+    dd->hash[i] = h;
+    memcpy (&dd->rec[i], utp, sizeof (STRUCT_UTMP));
+
+    return 0;
+}
+
+/* Merge the 'ninputs' wtmp files 'inputs' into the new file 'output', in
+ * time order.  The records are written in the native layout.  The output
+ * file is written beside 'output' and renamed when complete, with the
+ * mode and the owner of the first input: 'output' can be one of the
+ * inputs.  The number of records written and of the duplicates dropped
+ * are returned in 'nrec' and 'ndup'.  Return 0 or a WTMP_E* error code.  */
+int
+wtmpmerge (const char *output, char *const *inputs, int ninputs, int flags,
+           unsigned long *nrec, unsigned long *ndup)
+{
+    struct mergein *in = NULL;
+    struct dedup *dd = NULL;
+    struct wtmpwriter wr;
+    struct stat sb;
+    char *tmppath = NULL;
+    int *heap = NULL;
+    int i, n = 0, fd = -1, rc = WTMP_ESYS, saved_errno, prevphase;
+
+    *nrec = *ndup = 0;
+    wr.buf = NULL;
+    prevphase = STATS_PHASE (WTMPSTATS_OPEN);
+
+    if ((in = calloc (ninputs, sizeof (struct mergein))) == NULL ||
+        (heap = malloc (ninputs * sizeof (int))) == NULL ||
+        ((flags & WTMPMERGE_DEDUP) &&
+         (dd = calloc (1, sizeof (struct dedup))) == NULL))
+        goto out;
+    STATS_ADD (allocs, dd ? 3 : 2);
+
+    for (i = 0; i < ninputs; i++)
+      {
+          if ((rc = wtmpreader_open (&in[i].rd, inputs[i],
+                                     WTMPREADER_ASYNC |
+                                     WTMPREADER_DONTNEED)) < 0)
+              goto out;
+          in[i].open = 1;
+          if ((in[i].utp = wtmpreader_next (&in[i].rd)) != NULL)
+              heap[n++] = i;
+          else if ((rc = wtmpreader_error (&in[i].rd)) < 0)
+              goto out;
+      }
+    for (i = n / 2 - 1; i >= 0; i--)
+        siftdown (in, heap, n, i);
+
+    rc = WTMP_ESYS;
+    if (fstat (in[0].rd.fd, &sb) < 0)
+        goto out;
+    if ((tmppath = malloc (strlen (output) + sizeof (".tmp"))) == NULL)
+        goto out;
+    sprintf (tmppath, "%s.tmp", output);
+    if ((fd = open (tmppath, O_WRONLY | O_CREAT | O_TRUNC,
+                    sb.st_mode & 0666)) < 0)
+        goto out;
+    if (wtmpwriter_open (&wr, fd, MERGE_NREC * sizeof (STRUCT_UTMP)) < 0)
+        goto out;
+
+    STATS_PHASE (WTMPSTATS_SCAN);
+    while (n > 0)
+      {
+          struct mergein *top = &in[heap[0]];
+
+          if (dd && duplicate (dd, top->utp))
+              (*ndup)++;
+          else
+            {
+                if (wtmpwriter_put (&wr, top->utp, sizeof (STRUCT_UTMP)) < 0)
+                    goto out;
+                (*nrec)++;
+                STATS_ADD (written, 1);
+            }
+
+          if ((top->utp = wtmpreader_next (&top->rd)) == NULL)
+            {
+                if ((rc = wtmpreader_error (&top->rd)) < 0)
+                    goto out;
+                rc = WTMP_ESYS;
+                heap[0] = heap[--n];
+            }
+          siftdown (in, heap, n, 0);
+      }
+
+    STATS_PHASE (WTMPSTATS_WRITEBACK);
+    if (wtmpwriter_close (&wr) < 0)
+        goto out;
+
+    /* Only the superuser can give the file away: keep going otherwise */
+    if (fchown (fd, sb.st_uid, sb.st_gid) < 0 && errno != EPERM)
+        goto out;
+    if (fchmod (fd, sb.st_mode & 07777) < 0 || fsync (fd) < 0)
+        goto out;
+
+    rc = close (fd);
+    fd = -1;
+    if (rc < 0 || rename (tmppath, output) < 0)
+      {
+          rc = WTMP_ESYS;
+          goto out;
+      }
+    rc = 0;
+
+  out:
+    saved_errno = errno;
+    if (wr.buf)
+        wtmpwriter_close (&wr);
+    if (fd >= 0)
+      {
+          close (fd);
+          unlink (tmppath);
+      }
+    for (i = 0; in && i < ninputs; i++)
+        if (in[i].open)
+            wtmpreader_close (&in[i].rd);
+    free (tmppath);
+    free (heap);
+    free (dd);
+    free (in);
+    STATS_PHASE (prevphase);
+    errno = saved_errno;
+
+    return rc;
+}
@@ -0,0 +1,263 @@
+/*
+ * wtmppair.c -- Streaming pairing of the login and logout records.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The records are fed in file order to a state machine that keeps the
+ * session open on each terminal line, with the same rules as last(1):
+ *
+ *   USER_PROCESS   closes the session open on its line (R_NORMAL, at the
+ *                  time of the new login) and opens a new one
+ *   DEAD_PROCESS   closes the session open on its line (R_NORMAL)
+ *   RUN_LVL 0, 6   (shutdown) closes all the open sessions (R_DOWN)
+ *   BOOT_TIME      closes all the open sessions (R_CRASH: no shutdown)
+ *   OLD_TIME       followed by NEW_TIME: the clock has been changed; the
+ *                  change is subtracted from the duration of the sessions
+ *                  open across it
+ *
+ * A record costs a lookup in the hash table of the lines; closing all the
+ * sessions at a boot walks the list of the open ones, each session being
+ * closed once.  The sessions are allocated by the caller, that only passes
+ * the ones it is interested in: the logins of the other sessions still
+ * occupy their line.  The caller can be told when a session is closed (see
+ * wtmppair_onclose), to reuse it.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <time.h>
+
+#include "wtmpclean.h"
+
+#define PAIR_HASHSIZE  1021
+
+/* A terminal line and the session open on it */
+struct pairline
+{
+    char name[sizeof (((STRUCT_UTMP *) 0)->ut_line)];
+    struct utmpxlist *open;     /* NULL if none, or not of interest */
+    time_t shift;               /* clock changes before the login */
+    struct pairline *next;      /* next in the hash chain */
+    struct pairline *aprev, *anext;     /* list of the lines in 'open' */
+};
+
+struct wtmppair
+{
+    struct pairline *lines[PAIR_HASHSIZE];
+    struct pairline *active;
+    time_t shift;               /* sum of the clock changes */
+    time_t oldtime;             /* time of the pending OLD_TIME record */
+    int oldpending;
+    void (*onclose) (struct utmpxlist *session, void *arg);
+    void *onclosearg;
+};
+
+struct wtmppair *
+wtmppair_new (void)
+{
+    struct wtmppair *pair;
+
+    if ((pair = calloc (1, sizeof (struct wtmppair))) == NULL)
+        return NULL;
+    STATS_ADD (allocs, 1);
+
+    return pair;
+}
+
+/* Forget the lines and the open sessions, which are left as they are */
+void
+wtmppair_reset (struct wtmppair *pair)
+{
+    struct pairline *l, *next;
+    int i;
+
+    for (i = 0; i < PAIR_HASHSIZE; i++)
+      {
+          for (l = pair->lines[i]; l; l = next)
+            {
+                next = l->next;
+                free (l);
+            }
+          pair->lines[i] = NULL;
+      }
+    pair->active = NULL;
+    pair->shift = pair->oldtime = 0;
+    pair->oldpending = 0;
+}
+
+/* Call 'fn' (with 'arg') on each session when it is closed, once its end
+ * is set: the session is no longer used by the pairing engine */
+void
+wtmppair_onclose (struct wtmppair *pair,
+                  void (*fn) (struct utmpxlist *session, void *arg),
+                  void *arg)
+{
+    pair->onclose = fn;
+    pair->onclosearg = arg;
+}
+
+void
+wtmppair_free (struct wtmppair *pair)
+{
+    if (!pair)
+        return;
+    wtmppair_reset (pair);
+    free (pair);
+}
+
+static struct pairline *
+linelookup (struct wtmppair *pair, const char *name)
+{
+    struct pairline *l;
+    unsigned int h = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof l->name && name[i]; i++)
+        h = h * 31 + (unsigned char) name[i];
+    h %= PAIR_HASHSIZE;
+
+    for (l = pair->lines[h]; l; l = l->next)
+        if (!strncmp (l->name, name, sizeof l->name))
+            return l;
+
+    if ((l = calloc (1, sizeof (struct pairline))) == NULL)
+        return NULL;
+    STATS_ADD (allocs, 1);
+    strncpy (l->name, name, sizeof l->name);
+    l->next = pair->lines[h];
+    pair->lines[h] = l;
+
+    return l;
+}
+
+/* End the session open on 'l' at the time 't' */
+static void
+sessionclose (struct wtmppair *pair, struct pairline *l, time_t t,
+              int ltype, off_t offset)
+{
+    struct utmpxlist *p = l->open;
+
+    p->eos = t;
+    p->delta = t - p->ut.ut_tv.tv_sec - (pair->shift - l->shift);
+    p->ltype = ltype;
+    PROBE3 (session_close, (long long) offset, p->ut.ut_line, (long) p->delta);
+
+    l->open = NULL;
+    if (l->aprev)
+        l->aprev->anext = l->anext;
+    else
+        pair->active = l->anext;
+    if (l->anext)
+        l->anext->aprev = l->aprev;
+    l->aprev = l->anext = NULL;
+
+    if (pair->onclose)
+        pair->onclose (p, pair->onclosearg);
+}
+
+/* Feed the record 'utp', found at 'offset' in the wtmp file (-1 if
+ * unknown), to the pairing engine.  If 'utp' is a login and 'session' is
+ * not NULL, the record is copied in 'session' and the end of the session
+ * is set (eos, delta and ltype) when a later record closes it; 'session'
+ * must stay valid until then.  The sessions still open at the end of the
+ * file are left as R_NONE.  Return 0 or WTMP_ESYS.  */
+int
+wtmppair_feed (struct wtmppair *pair, const STRUCT_UTMP *utp, int64_t offset,
+               struct utmpxlist *session)
+{
+    struct pairline *l;
+    time_t t = UT_TIME_MEMBER (utp);
+#ifdef RUN_LVL
+    char runlevel;
+#endif
+
+    switch (utp->ut_type)
+      {
+      default:
+          break;
+#ifdef RUN_LVL
+      case RUN_LVL:
+          runlevel = (UT_PID (utp) % 256);
+          if (runlevel != '0' && runlevel != '6' &&
+              strncmp (UT_USER (utp), "shutdown", sizeof (UT_USER (utp))))
+              break;
+          while (pair->active)
+              sessionclose (pair, pair->active, t, R_DOWN, offset);
+          break;
+#endif
+      case BOOT_TIME:
+          while (pair->active)
+              sessionclose (pair, pair->active, t, R_CRASH, offset);
+          break;
+      case OLD_TIME:
+          pair->oldtime = t;
+          pair->oldpending = 1;
+          break;
+      case NEW_TIME:
+          if (pair->oldpending)
+              pair->shift += t - pair->oldtime;
+          pair->oldpending = 0;
+          break;
+      case USER_PROCESS:
+      case DEAD_PROCESS:
+          if ((l = linelookup (pair, utp->ut_line)) == NULL)
+              return WTMP_ESYS;
+          if (l->open)
+              sessionclose (pair, l, t, R_NORMAL, offset);
+          if (utp->ut_type == DEAD_PROCESS || !session)
+              break;
+
+          memcpy (&session->ut, utp, sizeof (STRUCT_UTMP));
+          session->eos = 0;
+          session->delta = 0;
+          session->ltype = R_NONE;
+          PROBE3 (session_open, (long long) offset, utp->ut_line,
+                  UT_USER (utp));
+
+          l->open = session;
+          l->shift = pair->shift;
+          l->aprev = NULL;
+          l->anext = pair->active;
+          if (pair->active)
+              pair->active->aprev = l;
+          pair->active = l;
+          break;
+      }
+
+    return 0;
+}
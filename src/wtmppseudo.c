@@ -0,0 +1,326 @@
+/*
+ * wtmppseudo.c -- Keyed pseudonymization of the users and hosts.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The user and host names of the login records are replaced by a token
+ * derived from the name with SipHash-2-4 and a secret 128-bit key: the
+ * same name always gets the same token with the same key, in every file,
+ * and the names cannot be recovered without the key.  The tokens are the
+ * letter 'u' (users) or 'h' (hosts) followed by the 64-bit hash in hex,
+ * which fits in ut_user and ut_host.  The address of the host, which
+ * identifies it as well as its name, is cleared.  The tokens already
+ * computed are kept in a table, since a few names make up most of the
+ * records.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "wtmpclean.h"
+
+#define TOKEN_LEN  17           /* prefix and 16 hex digits */
+
+struct memo
+{
+    char *name;                 /* kind and name, or NULL if free */
+    uint32_t hash;
+    char token[TOKEN_LEN + 1];
+};
+
+struct wtmppseudo
+{
+    uint64_t k0, k1;
+    struct memo *memo;
+    size_t nmemo, memosize;     /* memosize is a power of 2 */
+};
+
+#define ROTL(x, b) (uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND \
+    do { \
+        v0 += v1; v1 = ROTL (v1, 13); v1 ^= v0; v0 = ROTL (v0, 32); \
+        v2 += v3; v3 = ROTL (v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = ROTL (v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = ROTL (v1, 17); v1 ^= v2; v2 = ROTL (v2, 32); \
+    } while (0)
+
+static inline uint64_t
+get64le (const unsigned char *p)
+{
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 |
+        (uint64_t) p[3] << 24 | (uint64_t) p[4] << 32 |
+        (uint64_t) p[5] << 40 | (uint64_t) p[6] << 48 |
+        (uint64_t) p[7] << 56;
+}
+
+/* SipHash-2-4 of the 'len' bytes at 'data' */
+static uint64_t
+siphash (const struct wtmppseudo *ps, const void *data, size_t len)
+{
+    const unsigned char *in = data, *end = in + len - len % 8;
+    uint64_t v0 = UINT64_C (0x736f6d6570736575) ^ ps->k0;
+    uint64_t v1 = UINT64_C (0x646f72616e646f6d) ^ ps->k1;
+    uint64_t v2 = UINT64_C (0x6c7967656e657261) ^ ps->k0;
+    uint64_t v3 = UINT64_C (0x7465646279746573) ^ ps->k1;
+    uint64_t m, b = (uint64_t) len << 56;
+    int i;
+
+    for (; in != end; in += 8)
+      {
+          m = get64le (in);
+          v3 ^= m;
+          SIPROUND;
+          SIPROUND;
+          v0 ^= m;
+      }
+    for (i = len % 8; i > 0; i--)
+        b |= (uint64_t) in[i - 1] << (8 * (i - 1));
+
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* Read the key, the first 16 bytes of 'keyfile', and set up the table of
+ * the tokens.  Return 0 or a WTMP_E* error code.  */
+int
+wtmppseudo_load (const char *keyfile, struct wtmppseudo **pseudo)
+{
+    struct wtmppseudo *ps;
+    unsigned char key[16];
+    size_t len = 0;
+    ssize_t nread;
+    int fd, saved_errno;
+
+    *pseudo = NULL;
+    if ((fd = open (keyfile, O_RDONLY)) < 0)
+        return WTMP_ESYS;
+    while (len < sizeof key)
+      {
+          if ((nread = read (fd, key + len, sizeof key - len)) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                saved_errno = errno;
+                close (fd);
+                errno = saved_errno;
+                return WTMP_ESYS;
+            }
+          if (nread == 0)
+              break;
+          len += nread;
+      }
+    close (fd);
+    if (len < sizeof key)
+        return WTMP_EKEY;
+
+    if ((ps = calloc (1, sizeof (struct wtmppseudo))) == NULL)
+        return WTMP_ESYS;
+    ps->k0 = get64le (key);
+    ps->k1 = get64le (key + 8);
+    memset (key, 0, sizeof key);
+
+    ps->memosize = 256;
+    if ((ps->memo = calloc (ps->memosize, sizeof (struct memo))) == NULL)
+      {
+          free (ps);
+          return WTMP_ESYS;
+      }
+    STATS_ADD (allocs, 2);
+
+    *pseudo = ps;
+    return 0;
+}
+
+void
+wtmppseudo_free (struct wtmppseudo *pseudo)
+{
+    size_t i;
+
+    if (!pseudo)
+        return;
+    for (i = 0; i < pseudo->memosize; i++)
+        free (pseudo->memo[i].name);
+    free (pseudo->memo);
+    memset (pseudo, 0, sizeof (struct wtmppseudo));
+    free (pseudo);
+}
+
+/* Double the size of the table of the tokens */
+static int
+memogrow (struct wtmppseudo *ps)
+{
+    struct memo *old = ps->memo, *m;
+    size_t oldsize = ps->memosize, i, j;
+
+    if ((m = calloc (2 * oldsize, sizeof (struct memo))) == NULL)
+        return WTMP_ESYS;
+    STATS_ADD (allocs, 1);
+    ps->memo = m;
+    ps->memosize = 2 * oldsize;
+
+    for (i = 0; i < oldsize; i++)
+        if (old[i].name)
+          {
+              for (j = old[i].hash & (ps->memosize - 1); m[j].name;
+                   j = (j + 1) & (ps->memosize - 1))
+                  ;
+              m[j] = old[i];
+          }
+    free (old);
+
+    return 0;
+}
+
+/* Return the token of the name of 'len' bytes at 'name', of the given
+ * 'kind' ('u' or 'h'), or NULL if out of memory */
+static const char *
+token (struct wtmppseudo *ps, int kind, const char *name, size_t len)
+{
+    char key[sizeof (((STRUCT_UTMP *) 0)->ut_host) + 2];
+    struct memo *m;
+    uint32_t h;
+    uint64_t v;
+    size_t i;
+    int d;
+
+    /* The kind is part of the key: a user and a host of the same name
+       get unrelated tokens */
+    key[0] = kind;
+    memcpy (key + 1, name, len);
+    key[len + 1] = '\0';
+    h = (uint32_t) wtmphash (key, len + 1);
+
+    for (i = h & (ps->memosize - 1); ps->memo[i].name;
+         i = (i + 1) & (ps->memosize - 1))
+        if (ps->memo[i].hash == h && !strcmp (ps->memo[i].name, key))
+            return ps->memo[i].token;
+
+    if (2 * (ps->nmemo + 1) > ps->memosize)
+      {
+          if (memogrow (ps) < 0)
+              return NULL;
+          for (i = h & (ps->memosize - 1); ps->memo[i].name;
+               i = (i + 1) & (ps->memosize - 1))
+              ;
+      }
+
+    m = &ps->memo[i];
+    if ((m->name = strdup (key)) == NULL)
+        return NULL;
+    STATS_ADD (allocs, 1);
+    m->hash = h;
+    ps->nmemo++;
+
+    v = siphash (ps, key, len + 1);
+    m->token[0] = kind;
+    for (i = 0; i < 16; i++)
+      {
+          d = (v >> (60 - 4 * i)) & 0xf;
+          m->token[1 + i] = d < 10 ? '0' + d : 'a' + d - 10;
+      }
+    m->token[TOKEN_LEN] = '\0';
+
+    return m->token;
+}
+
+/* Replace the field 'field' of 'size' bytes by its token, if not empty */
+static int
+pseudofield (struct wtmppseudo *ps, int kind, char *field, size_t size)
+{
+    const char *tok;
+    size_t len = strnlen (field, size);
+
+    if (len == 0)
+        return 0;
+    if ((tok = token (ps, kind, field, len)) == NULL)
+        return WTMP_ESYS;
+
+    memset (field, 0, size);
+    memcpy (field, tok, TOKEN_LEN < size ? TOKEN_LEN : size);
+    return 0;
+}
+
+static int
+pseudopatch (const STRUCT_UTMP *utp, STRUCT_UTMP *rec, void *arg)
+{
+    struct wtmppseudo *ps = arg;
+
+    /* The names of the boot, run level and clock records are not
+       identities, and the session pairing relies on them */
+    if (utp->ut_type != USER_PROCESS && utp->ut_type != LOGIN_PROCESS &&
+        utp->ut_type != DEAD_PROCESS)
+        return 0;
+
+    memcpy (rec, utp, sizeof (STRUCT_UTMP));
+    /* A name that cannot be hashed is cleared */
+    if (pseudofield (ps, 'u', UT_USER (rec), sizeof (UT_USER (rec))) < 0)
+        memset (UT_USER (rec), 0, sizeof (UT_USER (rec)));
+    if (pseudofield (ps, 'h', rec->ut_host, sizeof rec->ut_host) < 0)
+        memset (rec->ut_host, 0, sizeof rec->ut_host);
+#ifdef HAVE_UTP_UT_ADDR_V6
+    memset (rec->ut_addr_v6, 0, sizeof rec->ut_addr_v6);
+#endif
+
+    return memcmp (rec, utp, sizeof (STRUCT_UTMP)) != 0;
+}
+
+/* Replace the user and host names of the login records of 'wtmpfile' by
+ * their tokens, in a single pass (see wtmpedit_apply).  The tokens are
+ * kept in 'pseudo' for the next files.  */
+int
+wtmppseudo (const char *wtmpfile, struct wtmppseudo *pseudo,
+            const char *journal, unsigned int *cleanrec)
+{
+    /* The tokens are cached as the records are scanned */
+    return wtmpedit_apply (wtmpfile, pseudopatch, pseudo, 0, journal,
+                           cleanrec);
+}
@@ -0,0 +1,165 @@
+/*
+ * wtmpsessions.c -- Pairing of the login and logout records.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+#ifdef HAVE_STRINGS_H
+# include <strings.h>
+#endif
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>             /* kill */
+
+#include "wtmpclean.h"
+
+void
+wtmpsessions_free (struct utmpxlist *sessions)
+{
+    struct utmpxlist *next;
+
+    for (; sessions; sessions = next)
+      {
+          next = sessions->next;
+          free (sessions);
+      }
+}
+
+/* Pair the login records of 'user' with the matching logout records and
+ * store in 'sessions' the list of the sessions found in 'wtmpfile', in
+ * chronological order.  The sessions with no logout record are marked as
+ * still logged in (R_NOW) or gone (R_PHANTOM), according to the state of
+ * their process.  Return 0 or a WTMP_E* error code.  */
+int
+wtmpsessions (const char *wtmpfile, const char *user,
+              struct utmpxlist **sessions)
+{
+    struct utmpxlist *p, *curr = NULL, *utmpxlist = NULL;
+    STRUCT_UTMP *utp;
+    struct wtmpindex *idx;
+    struct wtmpreader rd;
+    struct wtmppair *pair;
+    int rc = 0, prevphase;
+
+    *sessions = NULL;
+    prevphase = STATS_PHASE (WTMPSTATS_OPEN);
+    if ((pair = wtmppair_new ()) == NULL)
+      {
+          STATS_PHASE (prevphase);
+          return WTMP_ESYS;
+      }
+
+    /* Only read the records we need if an up-to-date index is available,
+       otherwise scan the file with the native reader, which also decodes
+       the records written by hosts with a different utmpx layout */
+    if ((idx = wtmpindex_open (wtmpfile, user, IDX_QUERY_LIST)) == NULL &&
+        (rc = wtmpreader_open (&rd, wtmpfile,
+                               WTMPREADER_ASYNC | WTMPREADER_MMAP |
+                               WTMPREADER_DONTNEED |
+                               (wtmpreader_tail ? WTMPREADER_TAIL : 0))) < 0)
+      {
+          wtmppair_free (pair);
+          STATS_PHASE (prevphase);
+          return rc;
+      }
+
+    STATS_PHASE (WTMPSTATS_PAIR);
+    while ((utp = idx ? wtmpindex_next (idx) : wtmpreader_next (&rd)) != NULL)
+      {
+          p = NULL;
+          /* Only keep the sessions of 'user': the other logins are only
+             needed to close the sessions open on the same line */
+          if (utp->ut_type == USER_PROCESS &&
+              strncmp (UT_USER (utp), user, sizeof (UT_USER (utp))) == 0)
+            {
+                if ((p = malloc (sizeof (struct utmpxlist))) == NULL)
+                  {
+                      rc = WTMP_ESYS;
+                      goto out;
+                  }
+                STATS_ADD (allocs, 1);
+                STATS_ADD (matched, 1);
+                p->next = NULL;
+                if (utmpxlist == NULL)
+                  {
+                      utmpxlist = curr = p;
+                      p->prev = NULL;
+                  }
+                else
+                  {
+                      curr->next = p;
+                      p->prev = curr;
+                      curr = p;
+                  }
+            }
+          if ((rc = wtmppair_feed (pair, utp,
+                                   idx ? -1 : wtmpreader_tell (&rd), p)) < 0)
+              goto out;
+      }
+    rc = idx ? wtmpindex_error (idx) : wtmpreader_error (&rd);
+
+    STATS_PHASE (WTMPSTATS_LIVENESS);
+    for (p = utmpxlist; p; p = p->next)
+        if (p->ltype == R_NONE)
+          {
+              /* Is process still alive? */
+              if (p->ut.ut_pid > 0 && kill (p->ut.ut_pid, 0) != 0
+                  && errno == ESRCH)
+                  p->ltype = R_PHANTOM;
+              else
+                  p->ltype = R_NOW;
+          }
+
+  out:
+    wtmppair_free (pair);
+    if (idx)
+        wtmpindex_close (idx);
+    else
+        wtmpreader_close (&rd);
+
+    if (rc < 0)
+        wtmpsessions_free (utmpxlist);
+    else
+        *sessions = utmpxlist;
+    STATS_PHASE (prevphase);
+
+    return rc;
+}
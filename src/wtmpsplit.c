@@ -0,0 +1,373 @@
+/*
+ * wtmpsplit.c -- Split a wtmp file by day, week or month.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The wtmp file is read once and each record is appended to the file of
+ * its period (local time): <outdir>/<name>-YYYY-MM-DDTHH, <name>-YYYY-MM-DD,
+ * <name>-YYYY-Www (ISO 8601 week) or <name>-YYYY-MM.  The bounds of the
+ * period of the last record are kept, so the time of a record is only
+ * broken down when it falls out of them.  At most SPLIT_MAXOPEN output
+ * files are open, each one with its write buffer: when another one is
+ * needed, the least recently used one is flushed and closed, and it is
+ * opened again if a later record belongs to it.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wtmpclean.h"
+
+/* Maximum number of output files open at the same time */
+#define SPLIT_MAXOPEN   32
+
+/* Size of the write buffer of an open output file, in records */
+#define SPLIT_NREC      256
+
+#define SPLIT_HASHSIZE  1021
+
+struct part
+{
+    time_t start, end;          /* the period is [start, end) */
+    char *path;
+    struct wtmpwriter wr;       /* valid while the file is open */
+    off_t size;                 /* bytes written when closed */
+    int isopen;
+    struct part *hnext;         /* next in the hash chain */
+    struct part *prev, *next;   /* list of the open files, most recent first */
+};
+
+struct split
+{
+    const char *outdir, *name;
+    int period;
+    const struct stat *sb;      /* the wtmp file */
+    struct part *table[SPLIT_HASHSIZE];
+    struct part *mru, *lru;
+    unsigned int nopen, nfiles;
+};
+
+/* Compute the bounds [start, end) of the hour, day, week or month ('period'
+ * is one of the WTMPSPLIT_* values) including the time 't', in local time,
+ * and the suffix of its file name in 'suffix' of 'size' bytes.  Return 0 or
+ * WTMP_ESYS.  */
+int
+wtmpperiod (time_t t, int period, time_t *start, time_t *end, char *suffix,
+            size_t size)
+{
+    static const char *formats[] = {
+        NULL, "%Y-%m-%d", "%G-W%V", "%Y-%m", "%Y-%m-%dT%H"
+    };
+    struct tm tm;
+
+    if (period < WTMPSPLIT_DAY || period > WTMPSPLIT_HOUR)
+      {
+          errno = EINVAL;
+          return WTMP_ESYS;
+      }
+    if (localtime_r (&t, &tm) == NULL)
+        return WTMP_ESYS;
+    if (period == WTMPSPLIT_HOUR)
+      {
+          /* Keep the DST flag: the hour repeated when the clock goes back
+             is another period */
+          tm.tm_min = tm.tm_sec = 0;
+          if ((*start = mktime (&tm)) == (time_t) - 1)
+              return WTMP_ESYS;
+          *end = *start + 3600;
+          strftime (suffix, size, formats[period], &tm);
+          STATS_ADD (timeconv, 1);
+          return 0;
+      }
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    if (period == WTMPSPLIT_WEEK)
+        tm.tm_mday -= (tm.tm_wday + 6) % 7;     /* back to Monday */
+    else if (period == WTMPSPLIT_MONTH)
+        tm.tm_mday = 1;
+    tm.tm_isdst = -1;
+    if ((*start = mktime (&tm)) == (time_t) - 1)
+        return WTMP_ESYS;
+    strftime (suffix, size, formats[period], &tm);
+
+    if (period == WTMPSPLIT_MONTH)
+        tm.tm_mon++;
+    else
+        tm.tm_mday += period == WTMPSPLIT_WEEK ? 7 : 1;
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    if ((*end = mktime (&tm)) == (time_t) - 1)
+        return WTMP_ESYS;
+    STATS_ADD (timeconv, 1);
+
+    return 0;
+}
+
+static unsigned int
+hash (time_t start)
+{
+    return (unsigned long) start % SPLIT_HASHSIZE;
+}
+
+static void
+unlink_open (struct split *sp, struct part *p)
+{
+    if (p->prev)
+        p->prev->next = p->next;
+    else
+        sp->mru = p->next;
+    if (p->next)
+        p->next->prev = p->prev;
+    else
+        sp->lru = p->prev;
+    p->prev = p->next = NULL;
+}
+
+static void
+push_open (struct split *sp, struct part *p)
+{
+    p->prev = NULL;
+    p->next = sp->mru;
+    if (sp->mru)
+        sp->mru->prev = p;
+    else
+        sp->lru = p;
+    sp->mru = p;
+}
+
+/* Flush and close the output file of 'p' */
+static int
+partclose (struct split *sp, struct part *p)
+{
+    int fd = p->wr.fd, rc;
+
+    rc = wtmpwriter_close (&p->wr);
+    p->size = p->wr.offset;
+    if (fsync (fd) < 0)
+        rc = WTMP_ESYS;
+    if (close (fd) < 0)
+        rc = WTMP_ESYS;
+    p->isopen = 0;
+    unlink_open (sp, p);
+    sp->nopen--;
+
+    return rc;
+}
+
+/* Open the output file of 'p', creating it the first time with the owner
+ * and the mode of the wtmp file */
+static int
+partopen (struct split *sp, struct part *p)
+{
+    int fd, saved_errno;
+
+    if (sp->nopen == SPLIT_MAXOPEN && partclose (sp, sp->lru) < 0)
+        return WTMP_ESYS;
+
+    if (p->size == 0)
+      {
+          /* Never overwrite an archive */
+          if ((fd = open (p->path, O_WRONLY | O_CREAT | O_EXCL,
+                          sp->sb->st_mode & 0666)) < 0)
+              return WTMP_ESYS;
+          sp->nfiles++;
+          /* Only the superuser can give the file away: keep going */
+          if ((fchown (fd, sp->sb->st_uid, sp->sb->st_gid) < 0 &&
+               errno != EPERM) ||
+              fchmod (fd, sp->sb->st_mode & 07777) < 0)
+              goto error;
+      }
+    else if ((fd = open (p->path, O_WRONLY)) < 0)
+        return WTMP_ESYS;
+
+    if (wtmpwriter_open (&p->wr, fd, SPLIT_NREC * sizeof (STRUCT_UTMP)) < 0)
+        goto error;
+    p->wr.offset = p->size;
+    p->isopen = 1;
+    push_open (sp, p);
+    sp->nopen++;
+
+    return 0;
+
+  error:
+    saved_errno = errno;
+    close (fd);
+    errno = saved_errno;
+    return WTMP_ESYS;
+}
+
+/* Return the period including the time 't', creating it if needed */
+static struct part *
+partget (struct split *sp, time_t t)
+{
+    char suffix[32];
+    struct part *p;
+    time_t start, end;
+    unsigned int h;
+
+    if (wtmpperiod (t, sp->period, &start, &end, suffix, sizeof suffix) < 0)
+        return NULL;
+
+    h = hash (start);
+    for (p = sp->table[h]; p; p = p->hnext)
+        if (p->start == start)
+            return p;
+
+    if ((p = calloc (1, sizeof (struct part))) == NULL)
+        return NULL;
+    if ((p->path = malloc (strlen (sp->outdir) + strlen (sp->name) +
+                           strlen (suffix) + 3)) == NULL)
+      {
+          free (p);
+          return NULL;
+      }
+    STATS_ADD (allocs, 2);
+    sprintf (p->path, "%s/%s-%s", sp->outdir, sp->name, suffix);
+    p->start = start;
+    p->end = end;
+    p->hnext = sp->table[h];
+    sp->table[h] = p;
+
+    return p;
+}
+
+/* Copy each record of 'wtmpfile' to the file of its hour, day, week or month
+ * ('period' is one of the WTMPSPLIT_* values) in the directory 'outdir',
+ * in a single pass.  The files are named after 'wtmpfile', get its owner
+ * and mode and are never overwritten; the records are written in the
+ * native layout.  The number of records and of files written are returned
+ * in 'nrec' and 'nfiles'.  Return 0 or a WTMP_E* error code.  */
+int
+wtmpsplit (const char *wtmpfile, const char *outdir, int period,
+           unsigned long *nrec, unsigned int *nfiles)
+{
+    struct wtmpreader rd;
+    struct split sp;
+    struct stat sb;
+    struct part *cur = NULL, *p, *next;
+    STRUCT_UTMP *utp;
+    const char *slash;
+    time_t t;
+    int i, rc, saved_errno, prevphase;
+
+    *nrec = 0;
+    *nfiles = 0;
+    if (period < WTMPSPLIT_DAY || period > WTMPSPLIT_HOUR)
+      {
+          errno = EINVAL;
+          return WTMP_ESYS;
+      }
+
+    prevphase = STATS_PHASE (WTMPSTATS_OPEN);
+    if ((rc = wtmpreader_open (&rd, wtmpfile, WTMPREADER_ASYNC |
+                               WTMPREADER_MMAP | WTMPREADER_DONTNEED)) < 0)
+      {
+          STATS_PHASE (prevphase);
+          return rc;
+      }
+
+    memset (&sp, 0, sizeof sp);
+    sp.outdir = outdir;
+    sp.name = (slash = strrchr (wtmpfile, '/')) ? slash + 1 : wtmpfile;
+    sp.period = period;
+    sp.sb = &sb;
+
+    rc = WTMP_ESYS;
+    if (fstat (rd.fd, &sb) < 0)
+        goto out;
+
+    STATS_PHASE (WTMPSTATS_SCAN);
+    while ((utp = wtmpreader_next (&rd)))
+      {
+          t = UT_TIME_MEMBER (utp);
+          if (!cur || t < cur->start || t >= cur->end)
+            {
+                if ((cur = partget (&sp, t)) == NULL)
+                    goto out;
+                if (!cur->isopen)
+                  {
+                      if (partopen (&sp, cur) < 0)
+                          goto out;
+                  }
+                else if (cur != sp.mru)
+                  {
+                      unlink_open (&sp, cur);
+                      push_open (&sp, cur);
+                  }
+            }
+
+          if (wtmpwriter_put (&cur->wr, utp, sizeof (STRUCT_UTMP)) < 0)
+              goto out;
+          (*nrec)++;
+          STATS_ADD (written, 1);
+      }
+    if ((rc = wtmpreader_error (&rd)) < 0)
+        goto out;
+
+    STATS_PHASE (WTMPSTATS_WRITEBACK);
+    while (sp.mru)
+        if ((rc = partclose (&sp, sp.mru)) < 0)
+            goto out;
+    rc = 0;
+
+  out:
+    saved_errno = errno;
+    *nfiles = sp.nfiles;
+    while ((p = sp.mru))
+      {
+          wtmpwriter_close (&p->wr);
+          close (p->wr.fd);
+          unlink_open (&sp, p);
+      }
+    for (i = 0; i < SPLIT_HASHSIZE; i++)
+        for (p = sp.table[i]; p; p = next)
+          {
+              next = p->hnext;
+              free (p->path);
+              free (p);
+          }
+    wtmpreader_close (&rd);
+    STATS_PHASE (prevphase);
+    errno = saved_errno;
+
+    return rc;
+}
@@ -0,0 +1,87 @@
+/*
+ * wtmpstats.c -- Performance counters.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#include <time.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "wtmpclean.h"
+
+struct wtmpstats wtmpstats;
+int wtmpstats_enabled;
+
+static int curphase = WTMPSTATS_NONE;
+static struct timespec wallstart, cpustart;
+#ifdef HAVE_PTHREAD
+static pthread_t owner;         /* the thread timing the phases */
+static int owned;
+#endif
+
+static double
+elapsed (const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/* Charge the time elapsed since the last call to the current phase and
+ * enter 'phase'.  Return the phase left, to be entered again at the end of
+ * a nested phase.  Only the thread which entered the first phase times
+ * them: the calls of the other threads, such as the scanning threads of
+ * wtmpedit_apply(), do nothing and their time is charged to the phase of
+ * the thread waiting for them.  */
+int
+wtmpstats_phase (int phase)
+{
+    struct timespec wall, cpu;
+    int prev;
+
+#ifdef HAVE_PTHREAD
+    if (!owned)
+      {
+          owner = pthread_self ();
+          owned = 1;
+      }
+    else if (!pthread_equal (owner, pthread_self ()))
+        return WTMPSTATS_NONE;
+#endif
+
+    prev = curphase;
+    clock_gettime (CLOCK_MONOTONIC, &wall);
+    clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &cpu);
+
+    if (prev != WTMPSTATS_NONE)
+      {
+          wtmpstats.wall[prev] += elapsed (&wallstart, &wall);
+          wtmpstats.cpu[prev] += elapsed (&cpustart, &cpu);
+      }
+
+    wallstart = wall;
+    cpustart = cpu;
+    curphase = phase;
+
+    return prev;
+}
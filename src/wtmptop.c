@@ -0,0 +1,344 @@
+/*
+ * wtmptop.c -- Top sources and users of the failed logins (btmp).
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The login records (btmp holds one for each failed attempt) are counted by
+ * source address and by user with the Space-Saving algorithm (Metwally,
+ * Agrawal, El Abbadi, 2005): a fixed number of counters is kept, and a key
+ * with no counter takes over the smallest one, inheriting its count as the
+ * error.  Any key seen more than N / TOP_COUNTERS times out of N is sure to
+ * have a counter, and its count exceeds the true one by at most the error
+ * shown.  The counters are kept in a min-heap, to find the smallest one in
+ * constant time, and in a hash table.  The first seen time of a key that
+ * took over a counter is the time of its first record counted.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "wtmpclean.h"
+
+/* Number of counters of each table, at least */
+#define TOP_COUNTERS  1024
+
+/* A key is a tag ('a' for an address, 'h' for a host, 'u' for a user)
+ * followed by the address or the name */
+#define TOP_KEYSIZE   (sizeof (((STRUCT_UTMP *) 0)->ut_host) + 1)
+
+struct counter
+{
+    char key[TOP_KEYSIZE];
+    size_t keylen;
+    unsigned long long count, error;
+    time_t first, last;
+    unsigned int heappos;
+    int next;                   /* next in the hash chain, or -1 */
+};
+
+struct topk
+{
+    struct counter *c;
+    unsigned int *heap;         /* min-heap of the counters by count */
+    int *bucket;                /* heads of the hash chains */
+    unsigned int n, size, nbuckets;
+};
+
+static void
+topinit (struct topk *t, unsigned int size)
+{
+    unsigned int i;
+
+    t->n = 0;
+    t->size = size;
+    for (t->nbuckets = 1; t->nbuckets < 2 * size; t->nbuckets *= 2)
+        ;
+    if ((t->c = malloc (size * sizeof (struct counter))) == NULL ||
+        (t->heap = malloc (size * sizeof (unsigned int))) == NULL ||
+        (t->bucket = malloc (t->nbuckets * sizeof (int))) == NULL)
+        die (errno, "out of memory");
+    STATS_ADD (allocs, 3);
+    for (i = 0; i < t->nbuckets; i++)
+        t->bucket[i] = -1;
+}
+
+static void
+topfree (struct topk *t)
+{
+    free (t->c);
+    free (t->heap);
+    free (t->bucket);
+}
+
+static inline void
+heapswap (struct topk *t, unsigned int i, unsigned int j)
+{
+    unsigned int ci = t->heap[i], cj = t->heap[j];
+
+    t->heap[i] = cj;
+    t->heap[j] = ci;
+    t->c[cj].heappos = i;
+    t->c[ci].heappos = j;
+}
+
+/* Move down the counter at 'i', whose count has grown */
+static void
+siftdown (struct topk *t, unsigned int i)
+{
+    unsigned int child;
+
+    while ((child = 2 * i + 1) < t->n)
+      {
+          if (child + 1 < t->n &&
+              t->c[t->heap[child + 1]].count < t->c[t->heap[child]].count)
+              child++;
+          if (t->c[t->heap[child]].count >= t->c[t->heap[i]].count)
+              break;
+          heapswap (t, i, child);
+          i = child;
+      }
+}
+
+/* Move up the counter at 'i' */
+static void
+siftup (struct topk *t, unsigned int i)
+{
+    unsigned int parent;
+
+    for (; i > 0; i = parent)
+      {
+          parent = (i - 1) / 2;
+          if (t->c[t->heap[parent]].count <= t->c[t->heap[i]].count)
+              break;
+          heapswap (t, i, parent);
+      }
+}
+
+static void
+unchain (struct topk *t, int ci, uint32_t h)
+{
+    int *pp;
+
+    for (pp = &t->bucket[h & (t->nbuckets - 1)]; *pp != ci;
+         pp = &t->c[*pp].next)
+        ;
+    *pp = t->c[ci].next;
+}
+
+/* Count a record of the key 'key' of 'len' bytes, logged at 'time' */
+static void
+topadd (struct topk *t, const char *key, size_t len, time_t time)
+{
+    uint32_t h = (uint32_t) wtmphash (key, len);
+    struct counter *c;
+    int ci;
+
+    for (ci = t->bucket[h & (t->nbuckets - 1)]; ci >= 0; ci = c->next)
+      {
+          c = &t->c[ci];
+          if (c->keylen == len && !memcmp (c->key, key, len))
+            {
+                c->count++;
+                if (time < c->first)
+                    c->first = time;
+                if (time > c->last)
+                    c->last = time;
+                siftdown (t, c->heappos);
+                return;
+            }
+      }
+
+    if (t->n < t->size)
+      {
+          /* A new counter with a count of 1 is a smallest one */
+          ci = t->n++;
+          c = &t->c[ci];
+          c->count = 1;
+          c->error = 0;
+          t->heap[ci] = ci;
+          c->heappos = ci;
+          siftup (t, ci);
+      }
+    else
+      {
+          /* Take over the smallest counter */
+          ci = t->heap[0];
+          c = &t->c[ci];
+          unchain (t, ci, (uint32_t) wtmphash (c->key, c->keylen));
+          c->error = c->count;
+          c->count++;
+      }
+
+    memcpy (c->key, key, len);
+    c->keylen = len;
+    c->first = c->last = time;
+    c->next = t->bucket[h & (t->nbuckets - 1)];
+    t->bucket[h & (t->nbuckets - 1)] = ci;
+    siftdown (t, c->heappos);
+}
+
+static int
+bycount (const void *a, const void *b)
+{
+    const struct counter *x = a, *y = b;
+
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return x->first < y->first ? -1 : x->first > y->first;
+}
+
+/* Print the key of a counter as a host, an address or a user name */
+static void
+printkey (const struct counter *c)
+{
+    char buf[INET6_ADDRSTRLEN];
+    const unsigned char *addr = (const unsigned char *) c->key + 1;
+    int pos, family;
+
+    if (c->key[0] != 'a')
+      {
+          printf ("%-39.*s", (int) c->keylen - 1, c->key + 1);
+          return;
+      }
+
+    /* An unset address is printed as 0.0.0.0 */
+    if ((pos = wtmpaddrfield (addr, &family)) < 0)
+        pos = 0;
+    inet_ntop (family, addr + pos, buf, sizeof buf);
+    printf ("%-39s", buf);
+}
+
+static void
+topreport (struct topk *t, const char *what, const char *column,
+           unsigned int k)
+{
+    const struct counter *c;
+    unsigned int i;
+
+    qsort (t->c, t->n, sizeof (struct counter), bycount);
+    if (k > t->n)
+        k = t->n;
+
+    printf ("\nTop %u %s:\n", k, what);
+    printf ("%12s %10s  %-39s %-19s  %s\n",
+            "attempts", "error", column, "first seen", "last seen");
+    for (i = 0; i < k; i++)
+      {
+          c = &t->c[i];
+          printf ("%12llu %10llu  ", c->count, c->error);
+          printkey (c);
+          printf (" %-19s", timetostr (c->first));
+          printf ("  %s\n", timetostr (c->last));
+      }
+}
+
+/* Report the 'k' sources and users with the most login records of
+ * 'btmpfile', in a single pass and in bounded memory.  Return the number
+ * of the login records.  */
+unsigned long
+wtmptop (const char *btmpfile, unsigned int k)
+{
+    struct wtmpreader rd;
+    static const char noaddr[sizeof (((STRUCT_UTMP *) 0)->ut_addr_v6)];
+    struct topk sources, users;
+    STRUCT_UTMP *utp;
+    char key[TOP_KEYSIZE];
+    unsigned long nrec = 0;
+    size_t len;
+    time_t t;
+    int rc;
+
+    STATS_PHASE (WTMPSTATS_OPEN);
+    if ((rc = wtmpreader_open (&rd, btmpfile,
+                               WTMPREADER_ASYNC | WTMPREADER_MMAP |
+                               WTMPREADER_DONTNEED |
+                               (wtmpreader_tail ? WTMPREADER_TAIL : 0))) < 0)
+        die (0, "%s: %s", btmpfile, wtmpstrerror (rc));
+
+    topinit (&sources, k * 32 > TOP_COUNTERS ? k * 32 : TOP_COUNTERS);
+    topinit (&users, k * 32 > TOP_COUNTERS ? k * 32 : TOP_COUNTERS);
+
+    STATS_PHASE (WTMPSTATS_SCAN);
+    while ((utp = wtmpreader_next (&rd)) != NULL)
+      {
+          if (utp->ut_type != USER_PROCESS && utp->ut_type != LOGIN_PROCESS)
+              continue;
+          STATS_ADD (matched, 1);
+          nrec++;
+          t = UT_TIME_MEMBER (utp);
+
+          key[0] = 'u';
+          len = strnlen (UT_USER (utp), sizeof (UT_USER (utp)));
+          memcpy (key + 1, UT_USER (utp), len);
+          topadd (&users, key, len + 1, t);
+
+#ifdef HAVE_UTP_UT_ADDR_V6
+          if (memcmp (utp->ut_addr_v6, noaddr, sizeof utp->ut_addr_v6))
+            {
+                key[0] = 'a';
+                memcpy (key + 1, utp->ut_addr_v6, sizeof utp->ut_addr_v6);
+                topadd (&sources, key, sizeof utp->ut_addr_v6 + 1, t);
+                continue;
+            }
+#endif
+          key[0] = 'h';
+          len = strnlen (utp->ut_host, sizeof utp->ut_host);
+          memcpy (key + 1, utp->ut_host, len);
+          topadd (&sources, key, len + 1, t);
+      }
+    if ((rc = wtmpreader_error (&rd)) < 0)
+        die (errno, "error while reading %s", btmpfile);
+    wtmpreader_close (&rd);
+
+    STATS_PHASE (WTMPSTATS_FORMAT);
+    printf ("%s: %lu login attempt(s)\n", btmpfile, nrec);
+    topreport (&sources, "sources", "source", k);
+    topreport (&users, "users", "user", k);
+    fflush (stdout);
+    STATS_PHASE (WTMPSTATS_NONE);
+
+    topfree (&sources);
+    topfree (&users);
+
+    return nrec;
+}
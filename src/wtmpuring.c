@@ -0,0 +1,333 @@
+/*
+ * wtmpuring.c -- Asynchronous reads with io_uring.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A single io_uring instance is shared by all the readers open in the
+ * process, so that the reads of several wtmp files are in flight at the
+ * same time.  The ring is set up with the raw system calls (liburing is not
+ * required) when the first reader asks for it, and it is released with the
+ * last one.  The kernel support is probed at runtime: when io_uring is not
+ * available (old kernel, seccomp filter, kernel.io_uring_disabled) the
+ * readers fall back to the synchronous I/O.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#if defined HAVE_LINUX_IO_URING_H && defined HAVE_SYS_SYSCALL_H
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# if defined __NR_io_uring_setup && HAVE_DECL_IORING_REGISTER_PROBE
+#  define HAVE_IO_URING 1
+# endif
+#endif
+
+#include "wtmpclean.h"
+
+#ifdef HAVE_IO_URING
+
+/* Number of entries of the submission queue */
+#define URING_ENTRIES  32
+
+static struct
+{
+    int fd;
+    unsigned int refs;
+    int unusable;               /* the setup failed: do not try again */
+    unsigned int pending;       /* requests queued but not yet submitted */
+    unsigned int *sqhead, *sqtail, *sqarray, sqmask;
+    unsigned int *cqhead, *cqtail, cqmask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqring, *cqring;
+    size_t sqsize, cqsize, sqessize;
+} ring = { .fd = -1 };
+
+static int
+uringenter (unsigned int tosubmit, unsigned int minwait, unsigned int flags)
+{
+    return syscall (__NR_io_uring_enter, ring.fd, tosubmit, minwait, flags,
+                    NULL, 0);
+}
+
+static void
+uringfree (void)
+{
+    if (ring.sqes && ring.sqes != MAP_FAILED)
+        munmap (ring.sqes, ring.sqessize);
+    if (ring.cqring && ring.cqring != MAP_FAILED && ring.cqring != ring.sqring)
+        munmap (ring.cqring, ring.cqsize);
+    if (ring.sqring && ring.sqring != MAP_FAILED)
+        munmap (ring.sqring, ring.sqsize);
+    if (ring.fd >= 0)
+        close (ring.fd);
+
+    ring.fd = -1;
+    ring.sqes = NULL;
+    ring.sqring = ring.cqring = NULL;
+    ring.pending = 0;
+}
+
+/* Return 1 if the kernel supports IORING_OP_READ */
+static int
+uringprobe (void)
+{
+    struct io_uring_probe *probe;
+    size_t size;
+    int supported;
+
+    size = sizeof (struct io_uring_probe) +
+        IORING_OP_LAST * sizeof (struct io_uring_probe_op);
+    if ((probe = calloc (1, size)) == NULL)
+        return 0;
+
+    supported =
+        syscall (__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE,
+                 probe, IORING_OP_LAST) == 0 &&
+        probe->last_op >= IORING_OP_READ &&
+        (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+
+    free (probe);
+    return supported;
+}
+
+static int
+uringsetup (void)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset (&p, 0, sizeof p);
+    if ((ring.fd = syscall (__NR_io_uring_setup, URING_ENTRIES, &p)) < 0)
+        return WTMP_ESYS;
+    if (!uringprobe ())
+      {
+          uringfree ();
+          errno = ENOSYS;
+          return WTMP_ESYS;
+      }
+
+    ring.sqsize = p.sq_off.array + p.sq_entries * sizeof (unsigned int);
+    ring.cqsize = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+      {
+          if (ring.cqsize > ring.sqsize)
+              ring.sqsize = ring.cqsize;
+          ring.cqsize = ring.sqsize;
+      }
+
+    ring.sqring = mmap (NULL, ring.sqsize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sqring == MAP_FAILED)
+        goto error;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        ring.cqring = ring.sqring;
+    else if ((ring.cqring = mmap (NULL, ring.cqsize, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, ring.fd,
+                                  IORING_OFF_CQ_RING)) == MAP_FAILED)
+        goto error;
+    ring.sqessize = p.sq_entries * sizeof (struct io_uring_sqe);
+    ring.sqes = mmap (NULL, ring.sqessize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED)
+        goto error;
+
+    sq = ring.sqring;
+    ring.sqhead = (unsigned int *) (sq + p.sq_off.head);
+    ring.sqtail = (unsigned int *) (sq + p.sq_off.tail);
+    ring.sqarray = (unsigned int *) (sq + p.sq_off.array);
+    ring.sqmask = *(unsigned int *) (sq + p.sq_off.ring_mask);
+    cq = ring.cqring;
+    ring.cqhead = (unsigned int *) (cq + p.cq_off.head);
+    ring.cqtail = (unsigned int *) (cq + p.cq_off.tail);
+    ring.cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    ring.cqmask = *(unsigned int *) (cq + p.cq_off.ring_mask);
+
+    return 0;
+
+  error:
+    uringfree ();
+    return WTMP_ESYS;
+}
+
+/* Mark the completed requests as done */
+static void
+uringreap (void)
+{
+    struct io_uring_cqe *cqe;
+    struct wtmpuringreq *req;
+    unsigned int head, tail;
+
+    head = *ring.cqhead;
+    tail = __atomic_load_n (ring.cqtail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++)
+      {
+          cqe = &ring.cqes[head & ring.cqmask];
+          req = (struct wtmpuringreq *) (uintptr_t) cqe->user_data;
+          req->res = cqe->res;
+          req->done = 1;
+      }
+    __atomic_store_n (ring.cqhead, head, __ATOMIC_RELEASE);
+}
+
+/* Take a reference to the shared ring, setting it up if needed.  Return 0
+ * on success, WTMP_ESYS if io_uring cannot be used.  */
+int
+wtmpuring_get (void)
+{
+    if (ring.unusable)
+      {
+          errno = ENOSYS;
+          return WTMP_ESYS;
+      }
+    if (ring.refs == 0 && uringsetup () < 0)
+      {
+          ring.unusable = 1;
+          return WTMP_ESYS;
+      }
+
+    ring.refs++;
+    return 0;
+}
+
+/* Release a reference to the shared ring.  All the requests of the caller
+ * must be completed.  */
+void
+wtmpuring_put (void)
+{
+    if (ring.refs > 0 && --ring.refs == 0)
+        uringfree ();
+}
+
+/* Queue the read described by 'req'.  If the request cannot be queued, it
+ * is marked as done with the error in req->res, and WTMP_ESYS is
+ * returned.  */
+int
+wtmpuring_submit (struct wtmpuringreq *req)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int tail, idx;
+    int nsub;
+
+    req->start = PROBE_CLOCK ();
+    tail = *ring.sqtail;
+    if (tail - __atomic_load_n (ring.sqhead, __ATOMIC_ACQUIRE) > ring.sqmask)
+      {
+          req->res = -EBUSY;
+          req->done = 1;
+          errno = EBUSY;
+          return WTMP_ESYS;
+      }
+
+    idx = tail & ring.sqmask;
+    sqe = &ring.sqes[idx];
+    memset (sqe, 0, sizeof (struct io_uring_sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = req->fd;
+    sqe->off = req->offset;
+    sqe->addr = (uintptr_t) req->buf;
+    sqe->len = req->len;
+    sqe->user_data = (uintptr_t) req;
+    ring.sqarray[idx] = idx;
+    req->done = 0;
+    __atomic_store_n (ring.sqtail, tail + 1, __ATOMIC_RELEASE);
+    ring.pending++;
+
+    /* A failed submission is retried by wtmpuring_wait() */
+    if ((nsub = uringenter (ring.pending, 0, 0)) > 0)
+        ring.pending -= nsub;
+
+    return 0;
+}
+
+/* Wait for the completion of 'req' */
+int
+wtmpuring_wait (struct wtmpuringreq *req)
+{
+    int nsub;
+
+    for (uringreap (); !req->done; uringreap ())
+      {
+          if ((nsub = uringenter (ring.pending, 1, IORING_ENTER_GETEVENTS)) < 0)
+            {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                    continue;
+                return WTMP_ESYS;
+            }
+          ring.pending -= nsub;
+      }
+
+    return 0;
+}
+
+#else /* !HAVE_IO_URING */
+
+int
+wtmpuring_get (void)
+{
+    errno = ENOSYS;
+    return WTMP_ESYS;
+}
+
+void
+wtmpuring_put (void)
+{
+}
+
+int
+wtmpuring_submit (struct wtmpuringreq *req)
+{
+    req->res = -ENOSYS;
+    req->done = 1;
+    errno = ENOSYS;
+    return WTMP_ESYS;
+}
+
+int
+wtmpuring_wait (struct wtmpuringreq *req)
+{
+    (void) req;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ * wtmpusers.c -- Cached resolution of the user names.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The user names needed by a run are resolved together, before the wtmp
+ * file is scanned: on hosts where the user database is remote (LDAP, SSSD,
+ * NIS) each lookup can be slow, so the lookups run in parallel threads and
+ * their results are kept in a cache.  With --passwd the names are looked up
+ * in a local copy of /etc/passwd and the name service is not used at all.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# if !defined STDC_HEADERS && defined HAVE_MEMORY_H
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#include <errno.h>
+#include <pwd.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+#include <unistd.h>
+
+#include "wtmpclean.h"
+
+#define USERCACHE_HASHSIZE  251
+#define USERCACHE_NTHREADS  8   /* maximum number of concurrent lookups */
+
+struct usercache
+{
+    char *name;
+    int known;                  /* -1 if not resolved yet */
+    uid_t uid;                  /* (uid_t) -1 if unknown */
+    struct usercache *next;
+};
+
+static struct usercache *usercache[USERCACHE_HASHSIZE];
+static int usercache_local;     /* the names come from a passwd file */
+
+static struct usercache *
+usercache_lookup (const char *name, int create)
+{
+    struct usercache *e;
+    unsigned int h = 0;
+    const char *p;
+
+    for (p = name; *p; p++)
+        h = h * 31 + (unsigned char) *p;
+    h %= USERCACHE_HASHSIZE;
+
+    for (e = usercache[h]; e; e = e->next)
+        if (!strcmp (e->name, name))
+            return e;
+    if (!create)
+        return NULL;
+
+    if ((e = malloc (sizeof (struct usercache))) == NULL ||
+        (e->name = strdup (name)) == NULL)
+        die (errno, "out of memory");
+    e->known = -1;
+    e->uid = (uid_t) - 1;
+    e->next = usercache[h];
+    usercache[h] = e;
+
+    return e;
+}
+
+/* Take the user names from the passwd file 'passwdfile' instead of the name
+ * service.  */
+void
+usercache_load (const char *passwdfile)
+{
+    char line[1024], *colon, *uid, *end;
+    struct usercache *e;
+    FILE *fp;
+
+    if ((fp = fopen (passwdfile, "r")) == NULL)
+        die (errno, "cannot open %s", passwdfile);
+    while (fgets (line, sizeof line, fp))
+      {
+          if ((colon = strchr (line, ':')) == NULL || colon == line)
+              continue;
+          *colon = '\0';
+          e = usercache_lookup (line, 1);
+          e->known = 1;
+          /* name:password:uid:... */
+          if ((uid = strchr (colon + 1, ':')) != NULL)
+            {
+                e->uid = strtoul (uid + 1, &end, 10);
+                if (end == uid + 1 || *end != ':')
+                    e->uid = (uid_t) - 1;
+            }
+      }
+    if (ferror (fp))
+        die (errno, "error while reading %s", passwdfile);
+    fclose (fp);
+
+    usercache_local = 1;
+}
+
+/* Ask the name service whether the user 'name' exists, and its UID */
+static int
+userexists (const char *name, uid_t *uid)
+{
+#ifdef HAVE_GETPWNAM_R
+    struct passwd pwd, *pw = NULL;
+    long size = sysconf (_SC_GETPW_R_SIZE_MAX);
+    char *buf = NULL, *more;
+    int rc;
+
+    if (size <= 0)
+        size = 1024;
+    do
+      {
+          if ((more = realloc (buf, size)) == NULL)
+            {
+                free (buf);
+                return 0;
+            }
+          buf = more;
+          rc = getpwnam_r (name, &pwd, buf, size, &pw);
+          size *= 2;
+      }
+    while (rc == ERANGE);
+    if (pw)
+        *uid = pw->pw_uid;
+    free (buf);
+
+    return pw != NULL;
+#else
+    struct passwd *pw = getpwnam (name);
+
+    if (pw)
+        *uid = pw->pw_uid;
+    return pw != NULL;
+#endif
+}
+
+#if defined HAVE_PTHREAD && defined HAVE_GETPWNAM_R
+struct resolvejob
+{
+    struct usercache **pending;
+    size_t npending, first, step;
+};
+
+static void *
+resolvethread (void *arg)
+{
+    const struct resolvejob *job = arg;
+    size_t i;
+
+    for (i = job->first; i < job->npending; i += job->step)
+        job->pending[i]->known = userexists (job->pending[i]->name,
+                                             &job->pending[i]->uid);
+
+    return NULL;
+}
+#endif
+
+/* Resolve the 'n' user names 'names' (NULL entries are ignored) with a
+ * single batch of lookups, running in parallel when possible.  */
+void
+usercache_resolve (const char *const *names, size_t n)
+{
+    struct usercache **pending, *e;
+    size_t npending = 0, i;
+
+    if ((pending = malloc ((n + 1) * sizeof (struct usercache *))) == NULL)
+        die (errno, "out of memory");
+    for (i = 0; i < n; i++)
+        if (names[i] && (e = usercache_lookup (names[i], 1))->known < 0)
+          {
+              /* Only the names listed in the passwd file exist */
+              if (usercache_local)
+                  e->known = 0;
+              else
+                {
+                    e->known = -2;  /* queued */
+                    pending[npending++] = e;
+                }
+          }
+
+#if defined HAVE_PTHREAD && defined HAVE_GETPWNAM_R
+    if (npending > 1)
+      {
+          struct resolvejob jobs[USERCACHE_NTHREADS];
+          pthread_t threads[USERCACHE_NTHREADS];
+          size_t nthreads = npending < USERCACHE_NTHREADS ?
+              npending : USERCACHE_NTHREADS;
+          int started[USERCACHE_NTHREADS];
+
+          for (i = 0; i < nthreads; i++)
+            {
+                jobs[i].pending = pending;
+                jobs[i].npending = npending;
+                jobs[i].first = i;
+                jobs[i].step = nthreads;
+                started[i] =
+                    !pthread_create (&threads[i], NULL, resolvethread,
+                                     &jobs[i]);
+                if (!started[i])
+                    resolvethread (&jobs[i]);
+            }
+          for (i = 0; i < nthreads; i++)
+              if (started[i])
+                  pthread_join (threads[i], NULL);
+          npending = 0;
+      }
+#endif
+    for (i = 0; i < npending; i++)
+        pending[i]->known = userexists (pending[i]->name, &pending[i]->uid);
+
+    free (pending);
+}
+
+/* Return 1 if the user 'name' exists, resolving it if needed */
+int
+usercache_known (const char *name)
+{
+    struct usercache *e = usercache_lookup (name, 0);
+
+    if (!e || e->known < 0)
+      {
+          usercache_resolve (&name, 1);
+          e = usercache_lookup (name, 0);
+      }
+
+    return e->known;
+}
+
+/* Return 1 and the UID of the user 'name' in 'uid' if the user exists
+ * and its UID is known, resolving it if needed */
+int
+usercache_uid (const char *name, uid_t *uid)
+{
+    struct usercache *e;
+
+    if (!usercache_known (name))
+        return 0;
+    e = usercache_lookup (name, 0);
+    *uid = e->uid;
+
+    return e->uid != (uid_t) - 1;
+}
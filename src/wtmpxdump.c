@@ -47,12 +47,12 @@
 #include <errno.h>
 #include <time.h>
 #include <unistd.h>
-#include <signal.h>             /* kill */
 
 #include "wtmpclean.h"
 
-static void
-dumprecord (struct utmpxlist *p, int what)
+/* Print a session to 'stream' using the listing layout */
+void
+dumpsession (FILE *stream, const struct utmpxlist *p, int what)
 {
     char *ct;
     char buf[26];
@@ -60,12 +60,13 @@ dumprecord (struct utmpxlist *p, int what)
     char length[32];
     int mins, hours, days;
 
-    printf ("%-8.8s %-12.12s %-16.16s ",
+    fprintf (stream, "%-8.8s %-12.12s %-16.16s ",
             p->ut.ut_user, p->ut.ut_line, p->ut.ut_host);
 
     time_t time = p->ut.ut_tv.tv_sec;
     ct = ctime_r (&time, buf);
-    printf ("%10.10s %4.4s %5.5s ", ct, ct + 20, ct + 11);
+    STATS_ADD (timeconv, 1);
+    fprintf (stream, "%10.10s %4.4s %5.5s ", ct, ct + 20, ct + 11);
 
     mins = (p->delta / 60) % 60;
     hours = (p->delta / 3600) % 24;
@@ -82,10 +83,10 @@ dumprecord (struct utmpxlist *p, int what)
           strcpy (logintime, " ");
           length[0] = 0;
           break;
-/*    case R_CRASH:
- *        strcpy (logintime, "- crash");
- *        length[0] = 0;
- *        break;  */
+      case R_CRASH:
+          strcpy (logintime, "- crash");
+          length[0] = 0;
+          break;
       case R_DOWN:
           strcpy (logintime, "- down  ");
           break;
@@ -100,107 +101,33 @@ dumprecord (struct utmpxlist *p, int what)
       case R_NORMAL:
       default:
           ct = ctime_r (&p->eos, buf);
+          STATS_ADD (timeconv, 1);
           sprintf (logintime, "- %5.5s ", ct + 11);
       }
-    printf ("%s%s\n", logintime, length);
+    fprintf (stream, "%s%s\n", logintime, length);
 }
 
 void
 wtmpxdump (const char *wtmpfile, const char *user)
 {
-    struct utmpxlist *p, *curr = NULL, *next, *utmpxlist = NULL;
-    STRUCT_UTMP *utp;
-    char runlevel;
-    int down = 0;
+    struct utmpxlist *p, *sessions;
+    unsigned long n;
+    long long start;
+    int rc;
 
     if (access (wtmpfile, R_OK))
         die (errno, "cannot access the file");
 
-    /* Ignore the return value for now.
-       Solaris' utmpname returns 1 upon success -- which is contrary
-       to what the GNU libc version does.  In addition, older GNU libc
-       versions are actually void.   */
-    UTMP_NAME_FUNCTION (wtmpfile);
-
-    SET_UTMP_ENT ();
-
-    while ((utp = GET_UTMP_ENT ()) != NULL)
-      {
-          /*if (user && strncmp (UT_USER (utp), user, sizeof utp->ut_user))
-             continue; */
-
-          switch (utp->ut_type)
-            {
-            default:
-                break;
-            case RUN_LVL:
-                runlevel = (UT_PID (utp) % 256);
-                if ((runlevel == '0') || (runlevel == '6'))
-                    down = 1;
-                break;
-            case BOOT_TIME:
-                down = 0;
-                break;
-            case USER_PROCESS:
-                /*
-                 * Just store the data if it is interesting enough.
-                 */
-                if (strncmp (UT_USER (utp), user, sizeof (UT_USER (utp))) == 0)
-                  {
-                      if ((p = malloc (sizeof (struct utmpxlist))) == NULL)
-                          die (errno, "out of memory");
+    if ((rc = wtmpsessions (wtmpfile, user, &sessions)) < 0)
+        die (0, "%s: %s", wtmpfile, wtmpstrerror (rc));
 
-                      memcpy (&p->ut, utp, sizeof (STRUCT_UTMP));
-                      p->delta = 0;
-                      p->ltype = R_NONE;
-                      p->next = NULL;
-                      if (utmpxlist == NULL)
-                        {
-                            utmpxlist = curr = p;
-                            p->prev = NULL;
-                        }
-                      else
-                        {
-                            curr->next = p;
-                            p->prev = curr;
-                            curr = p;
-                        }
-                  }
-                break;
-            case DEAD_PROCESS:
-                for (p = curr; p; p = p->prev)
-                  {
-                      if (p->ut.ut_type != USER_PROCESS || p->ltype != R_NONE)
-                          continue;
-                      if (strncmp
-                          (p->ut.ut_line, utp->ut_line, sizeof utp->ut_line))
-                          continue;
+    STATS_PHASE (WTMPSTATS_FORMAT);
+    for (p = sessions, n = 0; p; p = p->next, n++)
+        dumpsession (stdout, p, p->ltype);
+    start = PROBE_CLOCK ();
+    fflush (stdout);
+    PROBE2 (flush, n, PROBE_CLOCK () - start);
+    STATS_PHASE (WTMPSTATS_NONE);
 
-                      p->eos = UT_TIME_MEMBER (utp);
-                      p->delta = UT_TIME_MEMBER (utp) - p->ut.ut_tv.tv_sec;
-                      p->ltype = (down ? R_DOWN : R_NORMAL);
-                  }
-                break;
-            }
-      }
-
-    END_UTMP_ENT ();
-
-    for (p = utmpxlist; p; p = next)
-      {
-          next = p->next;
-
-          if (p->ltype == R_NONE)
-            {
-                /* Is process still alive? */
-                if (p->ut.ut_pid > 0 && kill (p->ut.ut_pid, 0) != 0
-                    && errno == ESRCH)
-                    p->ltype = R_PHANTOM;
-                else
-                    p->ltype = R_NOW;
-            }
-
-          dumprecord (p, p->ltype);
-          free (p);
-      }
+    wtmpsessions_free (sessions);
 }
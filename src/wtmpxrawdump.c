@@ -54,105 +54,130 @@
 
 #include "wtmpclean.h"
 
-char *
-timetostr (const time_t rawtime)
+/* Print a record to 'stream' using the raw dump layout */
+void
+rawdumprecord (FILE *stream, const STRUCT_UTMP *utp)
 {
-    static char s[20];          /* [2008.09.06 14:30:00] */
-    struct tm tminfo;
+    struct in_addr addr;
+    char *addr_string, *time_string;
 
-    if (rawtime != 0)
+    /* FIXME: missing support for IPv6 */
+#ifdef HAVE_UTP_UT_ADDR_V6
+    addr.s_addr = utp->ut_addr_v6[0];
+#endif
+
+    addr_string = inet_ntoa (addr);
+    time_string = timetostr (UT_TIME_MEMBER (utp));
+
+    switch (utp->ut_type)
       {
-          localtime_r (&rawtime, &tminfo);
-          strftime (s, sizeof (s), "%Y.%m.%d %H:%M:%S", &tminfo);
+      default:
+          /* Note: also catch EMPTY/UT_UNKNOWN values */
+          fprintf (stream, "%-9s", "NONE");
+          break;
+#ifdef RUN_LVL
+          /* Undefined on AIX if _ALL_SOURCE is false */
+      case RUN_LVL:
+          fprintf (stream, "%-9s", "RUNLEVEL");
+          break;
+#endif
+      case BOOT_TIME:
+          fprintf (stream, "%-9s", "REBOOT");
+          break;
+      case OLD_TIME:
+      case NEW_TIME:
+          /* FIXME */
+          break;
+      case INIT_PROCESS:
+          fprintf (stream, "%-9s", "INIT");
+          break;
+      case LOGIN_PROCESS:
+          fprintf (stream, "%-9s", "LOGIN");
+          break;
+      case USER_PROCESS:
+          fprintf (stream, "%-9.*s", (int) sizeof (UT_USER (utp)),
+                   UT_USER (utp));
+          break;
+      case DEAD_PROCESS:
+          fprintf (stream, "%-9s", "DEAD");
+          break;
+#ifdef ACCOUNTING
+          /* Undefined on AIX if _ALL_SOURCE is false */
+      case ACCOUNTING:
+          fprintf (stream, "%-9s", "ACCOUNT");
+          break;
+#endif
       }
-    else
-        s[0] = '\0';
 
-    return s;
+    /* pid */
+    UT_PID (utp) ? fprintf (stream, "[%05d]", UT_PID (utp))
+        : fprintf (stream, "[%5s]", "-");
+
+    /*     line      id       host      addr       date&time */
+    fprintf
+        (stream, " [%-12.*s] [%-4.*s] [%-19.*s] [%-15.15s] [%-19.19s]\n",
+         UT_LINESIZE, utp->ut_line,
+         (int)sizeof (utp->ut_id), utp->ut_id,
+         UT_HOSTSIZE, utp->ut_host, addr_string, time_string);
 }
 
+/* Print the records of 'user' (all if NULL) whose time matches
+ * 'timepattern' (all if NULL) */
 void
-wtmpxrawdump (const char *wtmpfile, const char *user)
+wtmpxrawdump (const char *wtmpfile, const char *user, const char *timepattern)
 {
     STRUCT_UTMP *utp;
-    struct in_addr addr;
-    char *addr_string, *time_string;
+    struct wtmptime *tp = NULL;
+    struct wtmpindex *idx;
+    struct wtmpreader rd;
+    unsigned long n = 0;
+    long long start;
+    int rc;
 
     if (access (wtmpfile, R_OK))
         die (errno, "cannot access the file");
+    if (timepattern && (rc = wtmptime_compile (timepattern, &tp)) < 0)
+        die (0, "%s: %s", timepattern, wtmpstrerror (rc));
+
+    STATS_PHASE (WTMPSTATS_OPEN);
+    /* Only read the records of 'user' if an up-to-date index is available,
+       otherwise scan the file with the native reader, which also decodes
+       the records written by hosts with a different utmpx layout */
+    if ((idx = wtmpindex_open (wtmpfile, user, IDX_QUERY_RAW)) == NULL)
+      {
+          if ((rc = wtmpreader_open (&rd, wtmpfile,
+                                     WTMPREADER_ASYNC | WTMPREADER_MMAP |
+                                     WTMPREADER_DONTNEED |
+                                     (wtmpreader_tail ? WTMPREADER_TAIL :
+                                      0))) < 0)
+              die (0, "%s: %s", wtmpfile, wtmpstrerror (rc));
+      }
 
-    /* Ignore the return value for now.
-       Solaris' utmpname returns 1 upon success -- which is contrary
-       to what the GNU libc version does.  In addition, older GNU libc
-       versions are actually void.   */
-    UTMP_NAME_FUNCTION (wtmpfile);
-
-    SET_UTMP_ENT ();
-
-    while ((utp = GET_UTMP_ENT ()) != NULL)
+    STATS_PHASE (WTMPSTATS_FORMAT);
+    while ((utp = idx ? wtmpindex_next (idx) : wtmpreader_next (&rd)) != NULL)
       {
           if (user && strncmp (UT_USER (utp), user, sizeof (UT_USER (utp))))
               continue;
+          if (tp && !wtmptime_match (tp, UT_TIME_MEMBER (utp)))
+              continue;
 
-          /* FIXME: missing support for IPv6 */
-#ifdef HAVE_UTP_UT_ADDR_V6
-          addr.s_addr = utp->ut_addr_v6[0];
-#endif
-
-          addr_string = inet_ntoa (addr);
-          time_string = timetostr (UT_TIME_MEMBER (utp));
-
-          switch (utp->ut_type)
-            {
-            default:
-                /* Note: also catch EMPTY/UT_UNKNOWN values */
-                printf ("%-9s", "NONE");
-                break;
-#ifdef RUN_LVL
-                /* Undefined on AIX if _ALL_SOURCE is false */
-            case RUN_LVL:
-                printf ("%-9s", "RUNLEVEL");
-                break;
-#endif
-            case BOOT_TIME:
-                printf ("%-9s", "REBOOT");
-                break;
-            case OLD_TIME:
-            case NEW_TIME:
-                /* FIXME */
-                break;
-            case INIT_PROCESS:
-                printf ("%-9s", "INIT");
-                break;
-            case LOGIN_PROCESS:
-                printf ("%-9s", "LOGIN");
-                break;
-            case USER_PROCESS:
-                printf ("%-9.*s", sizeof (UT_USER (utp)), UT_USER (utp));
-                break;
-            case DEAD_PROCESS:
-                printf ("%-9s", "DEAD");
-                break;
-#ifdef ACCOUNTING
-                /* Undefined on AIX if _ALL_SOURCE is false */
-            case ACCOUNTING:
-                printf ("%-9s", "ACCOUNT");
-                break;
-#endif
-            }
-
-          /* pid */
-          UT_PID (utp) ? printf ("[%05d]", UT_PID (utp)) : printf ("[%5s]",
-                                                                   "-");
-
-          /*     line      id       host      addr       date&time */
-          printf
-              (" [%-12.*s] [%-4.*s] [%-19.*s] [%-15.15s] [%-19.19s]\n",
-               UT_LINESIZE, utp->ut_line,
-               (int)sizeof (utp->ut_id), utp->ut_id,
-               UT_HOSTSIZE, utp->ut_host, addr_string, time_string);
-
+          STATS_ADD (matched, 1);
+          PROBE2 (match, (long long) (idx ? -1 : wtmpreader_tell (&rd)),
+                  (int) utp->ut_type);
+          rawdumprecord (stdout, utp);
+          n++;
       }
-
-    END_UTMP_ENT ();
+    start = PROBE_CLOCK ();
+    fflush (stdout);
+    PROBE2 (flush, n, PROBE_CLOCK () - start);
+    STATS_PHASE (WTMPSTATS_NONE);
+    rc = idx ? wtmpindex_error (idx) : wtmpreader_error (&rd);
+    if (rc < 0)
+        die (errno, "error while reading the wtmp file");
+
+    if (idx)
+        wtmpindex_close (idx);
+    else
+        wtmpreader_close (&rd);
+    wtmptime_free (tp);
 }
@@ -0,0 +1,44 @@
+#!/bin/sh
+# The records appended while the index is built are not covered by its
+# fingerprint, so that the index is seen out of date and then extended,
+# while a partial record at the end of the file is.
+
+: ${WTMPCLEAN=../src/wtmpclean} ${MKWTMP=./mkwtmp}
+wtmp=index.tmp
+recsize=`$MKWTMP -s` || exit 99
+rm -f $wtmp $wtmp.idx $wtmp.stop
+
+fail () { touch $wtmp.stop; echo "FAIL: $*"; exit 1; }
+
+$MKWTMP $wtmp 20000 root daemon || exit 99
+size=`wc -c < $wtmp`
+
+# Keep appending the sessions of bin during the build
+(while test ! -e $wtmp.stop; do $MKWTMP $wtmp 1 bin; done) &
+while test `wc -c < $wtmp` -eq $size; do :; done
+$WTMPCLEAN --build-index -f $wtmp >/dev/null || fail "build"
+touch $wtmp.stop
+wait
+
+# Fingerprinted size and number of records of the index header
+isize=`od -An -tu8 -j48 -N8 $wtmp.idx | tr -d ' '`
+inrec=`od -An -tu4 -j104 -N4 $wtmp.idx | tr -d ' '`
+test "$isize" = `expr $inrec \* $recsize` ||
+  fail "index of $inrec record(s) covering $isize bytes"
+
+$WTMPCLEAN --build-index -f $wtmp >/dev/null || fail "update"
+nbin=`$WTMPCLEAN -r -f $wtmp | grep -c '^bin '`
+test `$WTMPCLEAN -r -f $wtmp bin | grep -c '^bin '` -eq $nbin ||
+  fail "appended records missing from the index"
+
+# A partial record at the end of the file does not make the index stale
+printf xyz >> $wtmp
+$WTMPCLEAN --build-index -f $wtmp >/dev/null || fail "build with a tail"
+$WTMPCLEAN --build-index -f $wtmp | grep ' 0 new' >/dev/null ||
+  fail "index with a partial record rebuilt"
+$WTMPCLEAN --stats-timing -r -f $wtmp bin 2>&1 >/dev/null |
+  grep "records: $nbin scanned" >/dev/null ||
+  fail "index with a partial record not used"
+
+rm -f $wtmp $wtmp.idx $wtmp.stop
+exit 0
@@ -0,0 +1,26 @@
+#!/bin/sh
+# A lastlog file ending with a partial slot is rebuilt, with the partial
+# slot left as it is.
+
+: ${WTMPCLEAN=../src/wtmpclean} ${MKWTMP=./mkwtmp}
+wtmp=lastlog.tmp
+rm -f $wtmp $wtmp.ll
+
+fail () { echo "FAIL: $*"; exit 1; }
+
+# Only root is sure to be in the user database
+$MKWTMP $wtmp 4 root || exit 99
+$WTMPCLEAN --rebuild-lastlog=$wtmp.ll $wtmp >/dev/null || fail "rebuild"
+test -s $wtmp.ll || fail "no lastlog written"
+
+dd if=/dev/zero bs=100 count=1 >> $wtmp.ll 2>/dev/null
+size=`wc -c < $wtmp.ll`
+
+timeout=
+(timeout 1 true) >/dev/null 2>&1 && timeout="timeout 30"
+$timeout $WTMPCLEAN --rebuild-lastlog=$wtmp.ll $wtmp >/dev/null ||
+  fail "rebuild with a partial slot"
+test `wc -c < $wtmp.ll` -eq $size || fail "partial slot changed"
+
+rm -f $wtmp $wtmp.ll
+exit 0
@@ -0,0 +1,106 @@
+/*
+ * mkwtmp.c -- Write the wtmp files used by the test suite.
+ * Copyright (C) 2008,2009,2013-2014 by Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: mkwtmp -s
+ *        mkwtmp <wtmpfile> <sessions> <user>...
+ *
+ * The first form prints the size of a record.  The second one appends to
+ * <wtmpfile> a login and a logout record for each session, given to the
+ * users in turn, one hour apart: with an empty file, the login record of
+ * the session i is the record 2*i.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <stddef.h>
+#else
+# ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+
+#include "wtmpclean.h"
+
+static void
+record (FILE *stream, short type, const char *user, int session)
+{
+    STRUCT_UTMP ut;
+
+    memset (&ut, 0, sizeof ut);
+    ut.ut_type = type;
+#if HAVE_STRUCT_XTMP_UT_PID
+    ut.ut_pid = 1000 + session;
+#endif
+    snprintf (ut.ut_line, sizeof ut.ut_line, "pts/%d", session % 10);
+    if (user)
+        strncpy (UT_USER (&ut), user, sizeof UT_USER (&ut));
+    UT_TIME_MEMBER (&ut) = 1380000000 + session * 3600 +
+        (type == DEAD_PROCESS ? 1800 : 0);
+
+    if (fwrite (&ut, sizeof ut, 1, stream) != 1)
+      {
+          perror ("mkwtmp");
+          exit (EXIT_FAILURE);
+      }
+}
+
+int
+main (int argc, char **argv)
+{
+    FILE *stream;
+    int i, n;
+
+    if (argc == 2 && !strcmp (argv[1], "-s"))
+      {
+          printf ("%lu\n", (unsigned long) sizeof (STRUCT_UTMP));
+          return EXIT_SUCCESS;
+      }
+    if (argc < 4 || (n = atoi (argv[2])) < 0)
+      {
+          fprintf (stderr, "Usage: mkwtmp -s\n"
+                   "       mkwtmp <wtmpfile> <sessions> <user>...\n");
+          return EXIT_FAILURE;
+      }
+
+    if ((stream = fopen (argv[1], "ab")) == NULL)
+      {
+          perror (argv[1]);
+          return EXIT_FAILURE;
+      }
+    for (i = 0; i < n; i++)
+      {
+          record (stream, USER_PROCESS, argv[3 + i % (argc - 3)], i);
+          record (stream, DEAD_PROCESS, NULL, i);
+      }
+    if (fclose (stream) != 0)
+      {
+          perror (argv[1]);
+          return EXIT_FAILURE;
+      }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,48 @@
+#!/bin/sh
+# A revert stopped by a record changed after the edit can be retried once
+# the record is put back, and only restores the edits not yet undone.  A
+# record already holding its original content counts as restored.
+
+: ${WTMPCLEAN=../src/wtmpclean} ${MKWTMP=./mkwtmp}
+wtmp=revert.tmp
+recsize=`$MKWTMP -s` || exit 99
+rm -f $wtmp $wtmp.undo $wtmp.gen $wtmp.orig $wtmp.rec passwd.tmp
+
+fail () { echo "FAIL: $*"; exit 1; }
+
+printf 'root:x:0:0::/root:/bin/sh\nbin:x:1:1::/:/bin/sh\n' > passwd.tmp
+printf 'daemon:x:2:2::/:/bin/sh\nsys:x:3:3::/:/bin/sh\n' >> passwd.tmp
+$MKWTMP $wtmp 8 root daemon || exit 99
+cp $wtmp $wtmp.orig
+
+# Two edits, two blocks in the journal
+$WTMPCLEAN -f $wtmp --passwd=passwd.tmp root bin >/dev/null || fail "edit 1"
+$WTMPCLEAN -f $wtmp --passwd=passwd.tmp daemon sys >/dev/null || fail "edit 2"
+
+# Change the first record written by the first edit
+dd if=$wtmp of=$wtmp.rec bs=$recsize count=1 2>/dev/null
+printf 'X' | dd of=$wtmp bs=1 seek=`expr $recsize - 1` conv=notrunc \
+  2>/dev/null
+
+$WTMPCLEAN -f $wtmp --revert=$wtmp.undo >/dev/null 2>&1 &&
+  fail "revert of a changed record"
+test -s $wtmp.undo || fail "journal removed"
+$WTMPCLEAN -r -f $wtmp | grep '^sys' >/dev/null && fail "edit 2 not undone"
+
+# Put the record back and retry
+dd if=$wtmp.rec of=$wtmp bs=$recsize count=1 conv=notrunc 2>/dev/null
+$WTMPCLEAN -f $wtmp --revert=$wtmp.undo >/dev/null || fail "retry"
+cmp $wtmp $wtmp.orig >/dev/null || fail "file not restored"
+test ! -e $wtmp.undo || fail "journal left"
+
+# An edit journaled but written back only in part can be reverted: the
+# first record patched is put back as it was before the edit
+cp $wtmp.orig $wtmp
+$WTMPCLEAN -f $wtmp --passwd=passwd.tmp root bin >/dev/null || fail "edit 3"
+dd if=$wtmp.orig of=$wtmp bs=$recsize count=1 conv=notrunc 2>/dev/null
+$WTMPCLEAN -f $wtmp --revert=$wtmp.undo >/dev/null ||
+  fail "revert of a partial edit"
+cmp $wtmp $wtmp.orig >/dev/null || fail "partial edit not restored"
+
+rm -f $wtmp $wtmp.gen $wtmp.orig $wtmp.rec passwd.tmp
+exit 0